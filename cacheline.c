@@ -0,0 +1,163 @@
+/*
+伪共享微基准测试
+每个消费者线程不停地前移自己的序列号(和spmc2中消费者释放时写read_seq一样)，
+生产者线程不停地读取所有消费者的序列号求最小值(和gating一样)
+分别测试序列号紧挨着放在一个数组中，和每个序列号独占一个缓存行两种布局，消费者个数从1增加到-c指定的个数
+紧挨着放时8个序列号共享一个缓存行，消费者越多，每次写入让其它线程的缓存行失效的代价越大
+
+用法: cacheline [-c max_consumers] [-n updates_per_consumer]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#define CACHE_LINE      (64)
+#define CONSUMER_MAX    (64)
+
+#define LOAD_ACQUIRE(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+//独占一个缓存行的序列号
+typedef struct {
+    int64_t value;
+} __attribute__((aligned(CACHE_LINE))) PaddedSeq;
+
+typedef struct {
+    int64_t* seq;       // 第i个消费者的序列号为seq[i * stride]
+    int stride;         // 相邻两个序列号之间隔了几个int64_t
+    int consumer_num;
+    int64_t updates;    // 每个消费者前移的次数
+    int running;        // 还在运行的消费者个数
+    int start;          // 所有线程创建后再同时开始
+    int64_t scans;      // 生产者求最小值的次数
+    int64_t min_sum;    // 生产者求出的最小值之和，防止求最小值被优化掉
+} Bench;
+
+typedef struct {
+    Bench* bench;
+    int id;
+} ConsumerArg;
+
+static void* consumer(void* arg)
+{
+    ConsumerArg* a = (ConsumerArg*)arg;
+    Bench* b = a->bench;
+    int64_t* seq = &b->seq[a->id * b->stride];
+    while (!LOAD_ACQUIRE(&b->start)) {
+    }
+    for (int64_t i = 1; i <= b->updates; i++) {
+        STORE_RELEASE(seq, i);
+    }
+    __atomic_sub_fetch(&b->running, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void* producer(void* arg)
+{
+    Bench* b = (Bench*)arg;
+    int64_t scans = 0;
+    int64_t sum = 0;
+    while (!LOAD_ACQUIRE(&b->start)) {
+    }
+    while (LOAD_ACQUIRE(&b->running) > 0) {
+        int64_t min_seq = INT64_MAX;
+        for (int i = 0; i < b->consumer_num; i++) {
+            int64_t seq = LOAD_ACQUIRE(&b->seq[i * b->stride]);
+            if (seq < min_seq) {
+                min_seq = seq;
+            }
+        }
+        sum += min_seq;
+        scans++;
+    }
+    b->scans = scans;
+    b->min_sum = sum;
+    return NULL;
+}
+
+//运行一次，返回所有消费者全部前移完成的时间，单位纳秒
+static double run(int64_t* seq,int stride,int consumer_num,int64_t updates,int64_t* scans)
+{
+    Bench b;
+    memset(&b, 0, sizeof(b));
+    b.seq = seq;
+    b.stride = stride;
+    b.consumer_num = consumer_num;
+    b.updates = updates;
+    b.running = consumer_num;
+    for (int i = 0; i < consumer_num; i++) {
+        seq[i * stride] = 0;
+    }
+    pthread_t producerId;
+    pthread_t consumerIds[CONSUMER_MAX];
+    ConsumerArg args[CONSUMER_MAX];
+    pthread_create(&producerId, NULL, producer, &b);
+    for (int i = 0; i < consumer_num; i++) {
+        args[i].bench = &b;
+        args[i].id = i;
+        pthread_create(&consumerIds[i], NULL, consumer, &args[i]);
+    }
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    STORE_RELEASE(&b.start, 1);
+    for (int i = 0; i < consumer_num; i++) {
+        pthread_join(consumerIds[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    pthread_join(producerId, NULL);
+    *scans = b.scans;
+    return (end_time.tv_sec - start_time.tv_sec) * 1e9 + (end_time.tv_nsec - start_time.tv_nsec);
+}
+
+int main(int argc, char** argv)
+{
+    int opt = 0;
+    int consumer_max = 10;
+    int64_t updates = 10000000;
+    while ((opt = getopt(argc, argv, "c:n:")) != -1) {
+        switch (opt) {
+        case 'c':
+            consumer_max = atoi(optarg);
+            break;
+        case 'n':
+            updates = atoll(optarg);
+            break;
+        default:
+            printf("usage: %s [-c max_consumers] [-n updates_per_consumer]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (consumer_max < 1 || consumer_max > CONSUMER_MAX || updates < 1) {
+        printf("consumers must be 1..%d\n", CONSUMER_MAX);
+        return -1;
+    }
+    int64_t* packed = NULL;
+    PaddedSeq* padded = NULL;
+    if (0 != posix_memalign((void**)&packed, CACHE_LINE, sizeof(int64_t) * CONSUMER_MAX)
+        || 0 != posix_memalign((void**)&padded, CACHE_LINE, sizeof(PaddedSeq) * CONSUMER_MAX)) {
+        printf("posix_memalign failed\n");
+        return -1;
+    }
+    printf("%d cpus, %" PRId64 " updates per consumer, ns per update (producer min scans per us)\n",
+        (int)sysconf(_SC_NPROCESSORS_ONLN), updates);
+    printf("consumers      packed      padded   speedup\n");
+    for (int n = 1; n <= consumer_max; n++) {
+        int64_t packed_scans = 0;
+        int64_t padded_scans = 0;
+        double packed_ns = run(packed, 1, n, updates, &packed_scans);
+        double padded_ns = run(&padded[0].value, sizeof(PaddedSeq) / sizeof(int64_t), n, updates, &padded_scans);
+        double total = (double)updates * n;
+        printf("%9d %7.2f(%4.0f) %7.2f(%4.0f) %8.2fx\n", n,
+            packed_ns / total, packed_scans * 1e3 / packed_ns,
+            padded_ns / total, padded_scans * 1e3 / padded_ns,
+            packed_ns / padded_ns);
+    }
+    free(packed);
+    free(padded);
+    return 0;
+}
@@ -0,0 +1,50 @@
+/*
+loghist.h 对数线性直方图的桶计算，qbench和spmc2的延迟统计共用
+
+小于2^LOGHIST_SUB_BITS的值每个值一个桶，之后每个2的幂区间分成2^LOGHIST_SUB_BITS个桶，
+用桶的下界代表桶中的值，百分位数的误差不超过1/2^LOGHIST_SUB_BITS(6%)
+这里只计算下标和百分位数，计数数组放在哪里、是否按缓存行对齐、是否用原子操作读写都由调用方决定
+*/
+#ifndef LOGHIST_H
+#define LOGHIST_H
+
+#include <stdint.h>
+
+#define LOGHIST_SUB_BITS    (4)//每个2的幂区间分成2^LOGHIST_SUB_BITS个桶
+#define LOGHIST_BUCKETS     (64 << LOGHIST_SUB_BITS)
+
+static inline int loghist_index(uint64_t v)
+{
+    if (v < (1u << LOGHIST_SUB_BITS)) {
+        return (int)v;
+    }
+    int shift = 63 - __builtin_clzll(v) - LOGHIST_SUB_BITS;
+    return ((shift + 1) << LOGHIST_SUB_BITS) + (int)((v >> shift) & ((1u << LOGHIST_SUB_BITS) - 1));
+}
+
+//桶的下界
+static inline uint64_t loghist_value(int index)
+{
+    if (index < (1 << LOGHIST_SUB_BITS)) {
+        return (uint64_t)index;
+    }
+    int shift = (index >> LOGHIST_SUB_BITS) - 1;
+    uint64_t mantissa = (uint64_t)(index & ((1 << LOGHIST_SUB_BITS) - 1)) | (1u << LOGHIST_SUB_BITS);
+    return mantissa << shift;
+}
+
+//第p百分位所在桶的下界，count为bucket中的计数之和，数到最后一个桶还不够时返回max
+static inline uint64_t loghist_percentile(const uint64_t* bucket,uint64_t count,double p,uint64_t max)
+{
+    uint64_t rank = (uint64_t)(count * p / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < LOGHIST_BUCKETS; i++) {
+        seen += bucket[i];
+        if (seen > rank) {
+            return loghist_value(i);
+        }
+    }
+    return max;
+}
+
+#endif
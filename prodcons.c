@@ -24,6 +24,8 @@
    The exact behavior will vary according to the thread scheduling
    policy that is in force.
 
+   For large inputs, see the faster modes in textpipe.h.
+
    Warning:  The technique used here is only adequate for a single
    producer and a single consumer.  (What is the problem if we have
    more than one producer or consumer?)
@@ -45,6 +47,7 @@
    more details.
  */
 #include <pthread.h>
+#include "textpipe.h"
 
 #define BNUM 4               /* number of lines in the buffer */
 #define BSIZE 256            /* length of each line */
@@ -204,9 +207,13 @@ void * consumer(void *arg)
 
 /* main is the main program 
  */
-int main()
+int main(int argc, char *argv[])
 { pthread_t th1, th2;  /* the two thread objects */
   shared_buffer_t sb;  /* the buffer */
+  int status;
+
+  if ((status = tp_main(argc, argv)) >= 0)  /* -a, -b, -j: see textpipe.h */
+    return status;
 
   sb_init(&sb);  
   pthread_create(&th1, NULL, producer, &sb);  /* (1) */
@@ -245,4 +252,4 @@ int main()
     more important.
 
  (See the file "thread.h" for more information.)
- */
\ No newline at end of file
+ */
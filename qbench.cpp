@@ -0,0 +1,680 @@
+/*
+qbench.cpp 各个示例中的队列策略的吞吐量和延迟基准测试
+
+每种策略都按同样的方式运行：生产者写入固定条数的消息，消息中带写入时的时间戳，
+消费者取出后记录延迟，全部取完后退出，不打印每条消息
+输出 消息/秒、延迟的p50/p99/p99.9/最大值(纳秒)和进程CPU时间，并按生产者个数、消费者个数、容量扫描
+
+    策略             来源                       投递方式    限制
+    spin             prodcons0/hold            工作队列    单生产者单消费者，忙等
+    yield            prodcons1                 工作队列    单生产者单消费者，忙等时让出CPU
+    mutex            prodcons2/prodcons3/spmc/prodcons 工作队列 一把锁，非满和非空两个条件变量
+    lockfree         ringqueue.h               工作队列    容量必须是编译进来的2的幂
+    sharded          ringqueue.h/spmc -m sharded 工作队列  每个生产者一条通道，容量为每条通道的容量
+    bcast_mutex      spmc2 -m mutex            广播        一把锁，每个消费者一个读取位置
+    bcast_lockfree   ringqueue.h/spmc2 -m lockfree 广播    容量必须是编译进来的2的幂
+
+示例程序中的spin/yield用普通变量同步，这里换成acquire/release，保证测出的是同一种算法的正确版本
+广播时每条消息交给每个消费者，消息/秒按生产者写入的条数计算，延迟统计所有消费者收到的每一条
+延迟用对数线性直方图统计，每个2的幂区间分成16个桶，百分位数的误差不超过6%，最大值是精确的
+
+用法: qbench [-n messages] [-t strategy[,strategy]...] [-p producers[,...]] [-c consumers[,...]] [-s capacity[,...]] [-C]
+    -C 输出CSV，便于和上一次的结果比较
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <new>
+#include "ringqueue.h"
+#include "loghist.h"
+
+#define PRODUCER_MAX    (16)
+#define CONSUMER_MAX    (16)
+#define SWEEP_MAX       (16)//每个扫描参数最多的取值个数
+
+using namespace ringqueue;
+
+typedef struct {
+    uint64_t seq;   // 消息序号，所有生产者连续编号
+    uint64_t ts;    // 写入时的CLOCK_MONOTONIC纳秒
+} Msg;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+static double cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//对数线性直方图，桶的划分见loghist.h
+typedef struct {
+    uint64_t bucket[LOGHIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+} Histogram;
+
+static void hist_add(Histogram* h,uint64_t v)
+{
+    h->bucket[loghist_index(v)]++;
+    h->count++;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+static void hist_merge(Histogram* to,const Histogram* from)
+{
+    for (int i = 0; i < LOGHIST_BUCKETS; i++) {
+        to->bucket[i] += from->bucket[i];
+    }
+    to->count += from->count;
+    if (from->max > to->max) {
+        to->max = from->max;
+    }
+}
+
+static uint64_t hist_percentile(const Histogram* h,double p)
+{
+    return loghist_percentile(h->bucket, h->count, p, h->max);
+}
+
+typedef struct {
+    int producers;
+    int consumers;
+    int capacity;
+    int64_t messages;   // 所有生产者一共写入的消息数
+} Config;
+
+typedef struct {
+    double elapsed;
+    double cpu;
+    Histogram hist;
+    bool ok;
+} Result;
+
+/*
+每种策略提供:
+    push(producerId, msg)   阻塞直到写入
+    pop(consumerId, msg)    阻塞直到取出一条，close之后取完时返回false
+    close()                 所有生产者结束后调用
+    attach()                广播策略在生产者开始之前为每个消费者注册读者
+*/
+
+//prodcons0/prodcons1/hold的环形队列，in和out各自只有一个线程写，bYield时忙等中让出CPU
+template <bool bYield>
+class SpinRing {
+public:
+    static bool supported(const Config& cfg) { return 1 == cfg.producers && 1 == cfg.consumers; }
+    SpinRing(const Config& cfg) : size_(cfg.capacity + 1), in_(0), out_(0), closed_(0)
+    {
+        b_ = (Msg*)calloc(size_, sizeof(Msg));
+    }
+    ~SpinRing() { free(b_); }
+    void attach(int consumerId) {}
+    void push(int producerId,const Msg& msg)
+    {
+        int in = in_;
+        int next = (in + 1) % size_;
+        while (next == __atomic_load_n(&out_, __ATOMIC_ACQUIRE)) {
+            if (bYield) {
+                sched_yield();
+            }
+        }
+        b_[in] = msg;
+        __atomic_store_n(&in_, next, __ATOMIC_RELEASE);
+    }
+    bool pop(int consumerId,Msg& msg)
+    {
+        int out = out_;
+        while (out == __atomic_load_n(&in_, __ATOMIC_ACQUIRE)) {
+            if (__atomic_load_n(&closed_, __ATOMIC_ACQUIRE) && out == __atomic_load_n(&in_, __ATOMIC_ACQUIRE)) {
+                return false;
+            }
+            if (bYield) {
+                sched_yield();
+            }
+        }
+        msg = b_[out];
+        __atomic_store_n(&out_, (out + 1) % size_, __ATOMIC_RELEASE);
+        return true;
+    }
+    void close() { __atomic_store_n(&closed_, 1, __ATOMIC_RELEASE); }
+private:
+    Msg* b_;
+    int size_;      // 留一个空位区分满和空，所以比容量多1
+    int in_;
+    int out_;
+    int closed_;
+};
+
+//prodcons2/prodcons3/spmc/prodcons的互斥锁队列，生产者等非满，消费者等非空
+class MutexQueue {
+public:
+    static bool supported(const Config& cfg) { return true; }
+    MutexQueue(const Config& cfg) : size_(cfg.capacity), write_idx_(0), read_idx_(0), count_(0), closed_(false)
+    {
+        b_ = (Msg*)calloc(size_, sizeof(Msg));
+        pthread_mutex_init(&lock_, NULL);
+        pthread_cond_init(&full_, NULL);
+        pthread_cond_init(&empty_, NULL);
+    }
+    ~MutexQueue()
+    {
+        pthread_mutex_destroy(&lock_);
+        pthread_cond_destroy(&full_);
+        pthread_cond_destroy(&empty_);
+        free(b_);
+    }
+    void attach(int consumerId) {}
+    void push(int producerId,const Msg& msg)
+    {
+        pthread_mutex_lock(&lock_);
+        while (count_ == size_) {
+            pthread_cond_wait(&full_, &lock_);
+        }
+        b_[write_idx_] = msg;
+        write_idx_ = (write_idx_ + 1) % size_;
+        count_++;
+        pthread_cond_signal(&empty_);
+        pthread_mutex_unlock(&lock_);
+    }
+    bool pop(int consumerId,Msg& msg)
+    {
+        pthread_mutex_lock(&lock_);
+        while (0 == count_ && !closed_) {
+            pthread_cond_wait(&empty_, &lock_);
+        }
+        if (0 == count_) {
+            pthread_mutex_unlock(&lock_);
+            return false;
+        }
+        msg = b_[read_idx_];
+        read_idx_ = (read_idx_ + 1) % size_;
+        count_--;
+        pthread_cond_signal(&full_);
+        pthread_mutex_unlock(&lock_);
+        return true;
+    }
+    void close()
+    {
+        pthread_mutex_lock(&lock_);
+        closed_ = true;
+        pthread_cond_broadcast(&empty_);
+        pthread_mutex_unlock(&lock_);
+    }
+private:
+    Msg* b_;
+    int size_;
+    int write_idx_;
+    int read_idx_;
+    int count_;
+    bool closed_;
+    pthread_mutex_t lock_;
+    pthread_cond_t full_;
+    pthread_cond_t empty_;
+};
+
+//spmc2 -m mutex的广播队列，每个消费者一个读取序列号，生产者等最慢的消费者
+class MutexBroadcast {
+public:
+    static bool supported(const Config& cfg) { return true; }
+    MutexBroadcast(const Config& cfg) : size_(cfg.capacity), cursor_(0), consumers_(cfg.consumers), closed_(false)
+    {
+        b_ = (Msg*)calloc(size_, sizeof(Msg));
+        memset(read_seq_, 0, sizeof(read_seq_));
+        pthread_mutex_init(&lock_, NULL);
+        pthread_cond_init(&full_, NULL);
+        pthread_cond_init(&empty_, NULL);
+    }
+    ~MutexBroadcast()
+    {
+        pthread_mutex_destroy(&lock_);
+        pthread_cond_destroy(&full_);
+        pthread_cond_destroy(&empty_);
+        free(b_);
+    }
+    void attach(int consumerId) {}
+    void push(int producerId,const Msg& msg)
+    {
+        pthread_mutex_lock(&lock_);
+        while (cursor_ - slowest() >= size_) {
+            pthread_cond_wait(&full_, &lock_);
+        }
+        b_[cursor_ % size_] = msg;
+        cursor_++;
+        pthread_cond_broadcast(&empty_);
+        pthread_mutex_unlock(&lock_);
+    }
+    bool pop(int consumerId,Msg& msg)
+    {
+        pthread_mutex_lock(&lock_);
+        int64_t seq = read_seq_[consumerId];
+        while (seq == cursor_ && !closed_) {
+            pthread_cond_wait(&empty_, &lock_);
+        }
+        if (seq == cursor_) {
+            pthread_mutex_unlock(&lock_);
+            return false;
+        }
+        msg = b_[seq % size_];
+        read_seq_[consumerId] = seq + 1;
+        //释放的是最慢的那个位置时生产者可能在等待
+        if (cursor_ - seq >= size_) {
+            pthread_cond_broadcast(&full_);
+        }
+        pthread_mutex_unlock(&lock_);
+        return true;
+    }
+    void close()
+    {
+        pthread_mutex_lock(&lock_);
+        closed_ = true;
+        pthread_cond_broadcast(&empty_);
+        pthread_mutex_unlock(&lock_);
+    }
+private:
+    int64_t slowest()
+    {
+        int64_t min_seq = cursor_;
+        for (int i = 0; i < consumers_; i++) {
+            if (read_seq_[i] < min_seq) {
+                min_seq = read_seq_[i];
+            }
+        }
+        return min_seq;
+    }
+    Msg* b_;
+    int64_t size_;
+    int64_t cursor_;
+    int consumers_;
+    bool closed_;
+    int64_t read_seq_[CONSUMER_MAX];
+    pthread_mutex_t lock_;
+    pthread_cond_t full_;
+    pthread_cond_t empty_;
+};
+
+//ringqueue.h的工作队列，队列为空时关闭后再检查一次，避免漏掉关闭前写入的消息
+template <unsigned Capacity, Cardinality P, Cardinality C>
+class LockFreeWork {
+public:
+    static bool supported(const Config& cfg) { return true; }
+    LockFreeWork(const Config& cfg) : closed_(0) {}
+    void attach(int consumerId) {}
+    void push(int producerId,const Msg& msg) { queue_.push(msg); }
+    bool pop(int consumerId,Msg& msg)
+    {
+        int tries = 0;
+        while (!queue_.try_pop(msg)) {
+            if (__atomic_load_n(&closed_, __ATOMIC_ACQUIRE)) {
+                return queue_.try_pop(msg);
+            }
+            detail::backoff(&tries);
+        }
+        return true;
+    }
+    void close() { __atomic_store_n(&closed_, 1, __ATOMIC_RELEASE); }
+private:
+    Queue<Msg, Capacity, P, C, WORK_QUEUE> queue_;
+    int closed_;
+};
+
+//ringqueue.h的分片工作队列，每个生产者写自己的通道，消费者i的主通道为i % 生产者个数
+template <unsigned Capacity>
+class ShardedWork {
+public:
+    static bool supported(const Config& cfg) { return true; }
+    ShardedWork(const Config& cfg) : queue_(cfg.producers) {}
+    void attach(int consumerId) {}
+    void push(int producerId,const Msg& msg) { queue_.push(producerId, msg); }
+    bool pop(int consumerId,Msg& msg) { return queue_.pop(consumerId % queue_.lanes(), msg) >= 0; }
+    void close() { queue_.close(); }
+private:
+    ShardedQueue<Msg, Capacity, PRODUCER_MAX> queue_;
+};
+
+//ringqueue.h的广播队列，和spmc2的无锁模式相同的gating方式
+template <unsigned Capacity, Cardinality P>
+class LockFreeBroadcast {
+public:
+    static bool supported(const Config& cfg) { return true; }
+    LockFreeBroadcast(const Config& cfg) : closed_(0) {}
+    void attach(int consumerId) { readers_[consumerId] = queue_.attach(); }
+    void push(int producerId,const Msg& msg) { queue_.push(msg); }
+    bool pop(int consumerId,Msg& msg)
+    {
+        int tries = 0;
+        while (!queue_.try_pop(readers_[consumerId], msg)) {
+            if (__atomic_load_n(&closed_, __ATOMIC_ACQUIRE)) {
+                return queue_.try_pop(readers_[consumerId], msg);
+            }
+            detail::backoff(&tries);
+        }
+        return true;
+    }
+    void close() { __atomic_store_n(&closed_, 1, __ATOMIC_RELEASE); }
+private:
+    Queue<Msg, Capacity, P, MULTI, BROADCAST, CONSUMER_MAX> queue_;
+    int readers_[CONSUMER_MAX];
+    int closed_;
+};
+
+template <class S>
+struct Shared {
+    S* queue;
+    Config cfg;
+    int start;                      // 所有线程创建后再同时开始
+    Histogram hist[CONSUMER_MAX];
+    int64_t received[CONSUMER_MAX];
+};
+
+template <class S>
+struct ThreadArg {
+    Shared<S>* shared;
+    int id;
+};
+
+template <class S>
+static void* bench_producer(void* arg)
+{
+    ThreadArg<S>* a = (ThreadArg<S>*)arg;
+    Shared<S>* sh = a->shared;
+    //消息按生产者平均分配，余数给前面的生产者
+    int64_t count = sh->cfg.messages / sh->cfg.producers + (a->id < sh->cfg.messages % sh->cfg.producers ? 1 : 0);
+    while (!__atomic_load_n(&sh->start, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    Msg msg;
+    for (int64_t i = 0; i < count; i++) {
+        msg.seq = (uint64_t)(i * sh->cfg.producers + a->id);
+        msg.ts = now_ns();
+        sh->queue->push(a->id, msg);
+    }
+    return NULL;
+}
+
+template <class S>
+static void* bench_consumer(void* arg)
+{
+    ThreadArg<S>* a = (ThreadArg<S>*)arg;
+    Shared<S>* sh = a->shared;
+    Histogram* h = &sh->hist[a->id];
+    while (!__atomic_load_n(&sh->start, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    Msg msg;
+    int64_t received = 0;
+    while (sh->queue->pop(a->id, msg)) {
+        hist_add(h, now_ns() - msg.ts);
+        received++;
+    }
+    sh->received[a->id] = received;
+    return NULL;
+}
+
+//运行一种策略，组合不支持时返回false，bBroadcast时每个消费者都要收到全部消息
+template <class S>
+static bool run_strategy(const Config& cfg,bool bBroadcast,Result* r)
+{
+    if (!S::supported(cfg)) {
+        return false;
+    }
+    //队列中的下标按缓存行对齐，C++17之前new不保证这样的对齐
+    void* mem = NULL;
+    Shared<S>* sh = (Shared<S>*)calloc(1, sizeof(Shared<S>));
+    if (0 != posix_memalign(&mem, RINGQUEUE_CACHE_LINE, sizeof(S))) {
+        free(sh);
+        return false;
+    }
+    sh->queue = new (mem) S(cfg);
+    sh->cfg = cfg;
+    for (int i = 0; i < cfg.consumers; i++) {
+        sh->queue->attach(i);
+    }
+    pthread_t producerIds[PRODUCER_MAX];
+    pthread_t consumerIds[CONSUMER_MAX];
+    ThreadArg<S> producerArgs[PRODUCER_MAX];
+    ThreadArg<S> consumerArgs[CONSUMER_MAX];
+    for (int i = 0; i < cfg.consumers; i++) {
+        consumerArgs[i].shared = sh;
+        consumerArgs[i].id = i;
+        pthread_create(&consumerIds[i], NULL, bench_consumer<S>, &consumerArgs[i]);
+    }
+    for (int i = 0; i < cfg.producers; i++) {
+        producerArgs[i].shared = sh;
+        producerArgs[i].id = i;
+        pthread_create(&producerIds[i], NULL, bench_producer<S>, &producerArgs[i]);
+    }
+    double cpu_start = cpu_seconds();
+    uint64_t start = now_ns();
+    __atomic_store_n(&sh->start, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < cfg.producers; i++) {
+        pthread_join(producerIds[i], NULL);
+    }
+    sh->queue->close();
+    for (int i = 0; i < cfg.consumers; i++) {
+        pthread_join(consumerIds[i], NULL);
+    }
+    r->elapsed = (now_ns() - start) / 1e9;
+    r->cpu = cpu_seconds() - cpu_start;
+    memset(&r->hist, 0, sizeof(r->hist));
+    int64_t received = 0;
+    r->ok = true;
+    for (int i = 0; i < cfg.consumers; i++) {
+        hist_merge(&r->hist, &sh->hist[i]);
+        received += sh->received[i];
+        if (bBroadcast && sh->received[i] != cfg.messages) {
+            r->ok = false;
+        }
+    }
+    if (!bBroadcast && received != cfg.messages) {
+        r->ok = false;
+    }
+    sh->queue->~S();
+    free(mem);
+    free(sh);
+    return true;
+}
+
+//ringqueue的容量是模板参数，只支持编译进来的这些容量
+#define LOCKFREE_CAPACITY_CASES(F) F(16) F(64) F(256) F(1024) F(4096) F(16384) F(65536)
+
+template <unsigned Capacity>
+static bool bench_lockfree_cap(const Config& cfg,Result* r)
+{
+    if (1 == cfg.producers && 1 == cfg.consumers) {
+        return run_strategy<LockFreeWork<Capacity, SINGLE, SINGLE> >(cfg, false, r);
+    } else if (1 == cfg.producers) {
+        return run_strategy<LockFreeWork<Capacity, SINGLE, MULTI> >(cfg, false, r);
+    } else if (1 == cfg.consumers) {
+        return run_strategy<LockFreeWork<Capacity, MULTI, SINGLE> >(cfg, false, r);
+    }
+    return run_strategy<LockFreeWork<Capacity, MULTI, MULTI> >(cfg, false, r);
+}
+
+template <unsigned Capacity>
+static bool bench_bcast_lockfree_cap(const Config& cfg,Result* r)
+{
+    if (1 == cfg.producers) {
+        return run_strategy<LockFreeBroadcast<Capacity, SINGLE> >(cfg, true, r);
+    }
+    return run_strategy<LockFreeBroadcast<Capacity, MULTI> >(cfg, true, r);
+}
+
+static bool bench_spin(const Config& cfg,Result* r) { return run_strategy<SpinRing<false> >(cfg, false, r); }
+static bool bench_yield(const Config& cfg,Result* r) { return run_strategy<SpinRing<true> >(cfg, false, r); }
+static bool bench_mutex(const Config& cfg,Result* r) { return run_strategy<MutexQueue>(cfg, false, r); }
+static bool bench_bcast_mutex(const Config& cfg,Result* r) { return run_strategy<MutexBroadcast>(cfg, true, r); }
+
+static bool bench_lockfree(const Config& cfg,Result* r)
+{
+#define LOCKFREE_CASE(n) case n: return bench_lockfree_cap<n>(cfg, r);
+    switch (cfg.capacity) {
+    LOCKFREE_CAPACITY_CASES(LOCKFREE_CASE)
+    }
+#undef LOCKFREE_CASE
+    return false;
+}
+
+static bool bench_sharded(const Config& cfg,Result* r)
+{
+#define LOCKFREE_CASE(n) case n: return run_strategy<ShardedWork<n> >(cfg, false, r);
+    switch (cfg.capacity) {
+    LOCKFREE_CAPACITY_CASES(LOCKFREE_CASE)
+    }
+#undef LOCKFREE_CASE
+    return false;
+}
+
+static bool bench_bcast_lockfree(const Config& cfg,Result* r)
+{
+#define LOCKFREE_CASE(n) case n: return bench_bcast_lockfree_cap<n>(cfg, r);
+    switch (cfg.capacity) {
+    LOCKFREE_CAPACITY_CASES(LOCKFREE_CASE)
+    }
+#undef LOCKFREE_CASE
+    return false;
+}
+
+typedef struct {
+    const char* name;
+    bool (*run)(const Config& cfg,Result* r);
+} Strategy;
+
+static const Strategy g_strategies[] = {
+    {"spin", bench_spin},
+    {"yield", bench_yield},
+    {"mutex", bench_mutex},
+    {"lockfree", bench_lockfree},
+    {"sharded", bench_sharded},
+    {"bcast_mutex", bench_bcast_mutex},
+    {"bcast_lockfree", bench_bcast_lockfree},
+};
+#define STRATEGY_NUM ((int)(sizeof(g_strategies) / sizeof(g_strategies[0])))
+
+//解析逗号分隔的整数列表，返回个数
+static int parse_list(const char* arg,int* values,int min,int max)
+{
+    int num = 0;
+    const char* p = arg;
+    while (*p && num < SWEEP_MAX) {
+        int v = atoi(p);
+        if (v < min || v > max) {
+            return -1;
+        }
+        values[num++] = v;
+        p = strchr(p, ',');
+        if (NULL == p) {
+            break;
+        }
+        p++;
+    }
+    return num;
+}
+
+int main(int argc, char** argv)
+{
+    int opt = 0;
+    int64_t messages = 1000000;
+    const char* strategies = NULL;
+    int producers[SWEEP_MAX] = {1};
+    int consumers[SWEEP_MAX] = {1};
+    int capacities[SWEEP_MAX] = {1024};
+    int producer_num = 1;
+    int consumer_num = 1;
+    int capacity_num = 1;
+    bool bCsv = false;
+    while ((opt = getopt(argc, argv, "n:t:p:c:s:C")) != -1) {
+        switch (opt) {
+        case 'n':
+            messages = atoll(optarg);
+            break;
+        case 't':
+            strategies = optarg;
+            break;
+        case 'p':
+            producer_num = parse_list(optarg, producers, 1, PRODUCER_MAX);
+            break;
+        case 'c':
+            consumer_num = parse_list(optarg, consumers, 1, CONSUMER_MAX);
+            break;
+        case 's':
+            capacity_num = parse_list(optarg, capacities, 2, 1 << 24);
+            break;
+        case 'C':
+            bCsv = true;
+            break;
+        default:
+            producer_num = -1;
+            break;
+        }
+    }
+    if (messages < 1 || producer_num < 1 || consumer_num < 1 || capacity_num < 1) {
+        printf("usage: %s [-n messages] [-t strategy[,strategy]...] [-p producers[,...]] [-c consumers[,...]] [-s capacity[,...]] [-C]\n"
+            "\tstrategies: spin yield mutex lockfree sharded bcast_mutex bcast_lockfree\n", argv[0]);
+        return -1;
+    }
+    if (bCsv) {
+        printf("strategy,producers,consumers,capacity,messages,msgs_per_s,p50_ns,p99_ns,p999_ns,max_ns,cpu_s,ok\n");
+    } else {
+        printf("%ld cpus, %" PRId64 " messages per run, latency in ns\n", sysconf(_SC_NPROCESSORS_ONLN), messages);
+        printf("%-15s %3s %3s %6s %12s %9s %9s %9s %10s %7s\n",
+            "strategy", "P", "C", "cap", "msgs/s", "p50", "p99", "p99.9", "max", "cpu s");
+    }
+    int failed = 0;
+    for (int t = 0; t < STRATEGY_NUM; t++) {
+        //按名字精确匹配逗号分隔列表中的一项
+        if (strategies) {
+            const char* p = strstr(strategies, g_strategies[t].name);
+            size_t len = strlen(g_strategies[t].name);
+            while (p && ((p != strategies && ',' != p[-1]) || (p[len] && ',' != p[len]))) {
+                p = strstr(p + 1, g_strategies[t].name);
+            }
+            if (NULL == p) {
+                continue;
+            }
+        }
+        for (int pi = 0; pi < producer_num; pi++) {
+            for (int ci = 0; ci < consumer_num; ci++) {
+                for (int si = 0; si < capacity_num; si++) {
+                    Config cfg;
+                    cfg.producers = producers[pi];
+                    cfg.consumers = consumers[ci];
+                    cfg.capacity = capacities[si];
+                    cfg.messages = messages;
+                    Result r;
+                    if (!g_strategies[t].run(cfg, &r)) {
+                        continue;//这种组合不支持，比如spin的多生产者，或者lockfree不支持的容量
+                    }
+                    failed += r.ok ? 0 : 1;
+                    if (bCsv) {
+                        printf("%s,%d,%d,%d,%" PRId64 ",%.0f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.3f,%d\n",
+                            g_strategies[t].name, cfg.producers, cfg.consumers, cfg.capacity, messages, messages / r.elapsed,
+                            hist_percentile(&r.hist, 50), hist_percentile(&r.hist, 99),
+                            hist_percentile(&r.hist, 99.9), r.hist.max, r.cpu, r.ok ? 1 : 0);
+                    } else {
+                        printf("%-15s %3d %3d %6d %12.0f %9" PRIu64 " %9" PRIu64 " %9" PRIu64 " %10" PRIu64 " %7.3f%s\n",
+                            g_strategies[t].name, cfg.producers, cfg.consumers, cfg.capacity, messages / r.elapsed,
+                            hist_percentile(&r.hist, 50), hist_percentile(&r.hist, 99),
+                            hist_percentile(&r.hist, 99.9), r.hist.max, r.cpu, r.ok ? "" : " FAILED");
+                    }
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,632 @@
+/*
+ringqueue.h 仅头文件的有界循环队列模板库，从prodcons/spmc/spmc2的示例中提炼出来
+
+元素类型、容量、生产者个数、消费者个数、投递方式都是模板参数，每种组合编译出自己专用的实现，
+热点路径全部内联，不需要的原子操作(比如单生产者的CAS)在编译时就去掉
+
+    ringqueue::Queue<T, 容量, 生产者, 消费者, 投递方式, 最多读者个数>
+
+    容量        必须是2的幂，下标用掩码计算
+    生产者      ringqueue::SINGLE 或 ringqueue::MULTI
+    消费者      ringqueue::SINGLE 或 ringqueue::MULTI
+    投递方式    ringqueue::WORK_QUEUE 每个元素只交给一个消费者
+                ringqueue::BROADCAST  每个元素交给所有已注册的读者，和spmc2的无锁模式一样
+    最多读者    BROADCAST时读者表的大小，消费者为SINGLE时固定为1
+
+WORK_QUEUE:
+    bool try_push(const T&)    队列满时返回false
+    void push(const T&)        队列满时等待
+    bool try_pop(T&)           队列空时返回false
+    void pop(T&)               队列空时等待
+BROADCAST:
+    int  attach()              注册读者，从注册时最新发布的元素开始读取，读者表已满时返回-1
+    void detach(int reader)    注销读者，之后不再限制生产者
+    bool try_pop(int reader, T&)
+    void pop(int reader, T&)
+    try_push/push同上，最慢的读者决定生产者能否写入，没有读者时生产者不会阻塞
+
+分片的工作队列，每个生产者(或核)一条自己的通道，消费者先取自己的通道，空了再从其它通道窃取:
+    ringqueue::ShardedQueue<T, 每条通道的容量, 最多通道个数>
+    ShardedQueue(unsigned lanes)   通道个数，不超过最多通道个数
+    bool try_push(unsigned lane, const T&)
+    void push(unsigned lane, const T&)     通道满时等待
+    int  try_pop(unsigned home, T&)        先取home通道再窃取，返回取到的通道，所有通道都空时返回-1
+    int  pop(unsigned home, T&)            所有通道都空时停车，close之后取完时返回-1
+    void close()                           生产者都结束后调用，唤醒所有停车的消费者
+
+具体实现:
+    单生产者单消费者的WORK_QUEUE   Lamport环形队列，两边各自缓存对方的下标，只在看起来满或空时才读取对方的缓存行
+    其它WORK_QUEUE                 每个槽位带序列号的有界队列(Vyukov)，只有多个线程竞争的一侧用CAS，
+                                   push/pop自旋和让出CPU后仍然满或空时在futex上停车，另一侧只在有停车的线程时才唤醒
+    BROADCAST                      每个读者一个序列号，生产者缓存最慢读者的位置(gating)，
+                                   多生产者用CAS申请序列号，每个槽位记录已发布的序列号，读者按槽位检查是否可读，
+                                   和spmc2一样把连续发布的前缀推进到cursor，gating和新读者的起点都不超过cursor
+
+    ShardedQueue                   每条通道是一个多生产者多消费者的WORK_QUEUE，没有窃取时只有通道的主人访问它的缓存行，
+                                   消费者在所有通道都空时才在共用的事件计数上停车，生产者写入后只在有停车的消费者时才唤醒
+
+需要GCC的__atomic内建函数，兼容-ansi(C++98)
+队列对象中的下标按缓存行对齐，放在堆上时用posix_memalign分配再placement new，C++17之前new不保证这样的对齐
+T需要可以默认构造和赋值
+*/
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace ringqueue {
+
+enum Cardinality { SINGLE = 0, MULTI = 1 };
+enum Delivery { WORK_QUEUE = 0, BROADCAST = 1 };
+
+#define RINGQUEUE_CACHE_LINE    (64)
+#define RINGQUEUE_ALIGNED       __attribute__((aligned(RINGQUEUE_CACHE_LINE)))
+#define RINGQUEUE_SPIN_TRIES    (1000)//等待时自旋的次数，之后每次都让出CPU
+#define RINGQUEUE_YIELD_TRIES   (100)//会停车的等待在自旋之后让出CPU的次数，之后才停车
+
+namespace detail {
+
+//编译时检查，条件不成立时使用未定义的特化
+template <bool B> struct StaticCheck;
+template <> struct StaticCheck<true> { enum { ok = 1 }; };
+
+template <typename V> inline V load_relaxed(const V* p) { return __atomic_load_n(p, __ATOMIC_RELAXED); }
+template <typename V> inline V load_acquire(const V* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+template <typename V> inline V load_seq_cst(const V* p) { return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+template <typename V> inline void store_relaxed(V* p, V v) { __atomic_store_n(p, v, __ATOMIC_RELAXED); }
+template <typename V> inline void store_release(V* p, V v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+template <typename V> inline void store_seq_cst(V* p, V v) { __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+template <typename V> inline bool cas(V* p, V* expected, V desired)
+{
+    return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+//自旋的次数，只有一个CPU时对方在自旋期间不可能运行，直接让出CPU
+inline int spin_tries()
+{
+    static int tries = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RINGQUEUE_SPIN_TRIES : 0;
+    return tries;
+}
+
+//阻塞接口的等待，先自旋再让出CPU
+inline void backoff(int* tries)
+{
+    if (++*tries < spin_tries()) {
+        cpu_relax();
+    } else {
+        sched_yield();
+    }
+}
+
+//在*addr等于val时休眠，直到被唤醒，非Linux上退化为让出CPU
+inline void futex_wait(uint32_t* addr, uint32_t val)
+{
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    (void)addr;
+    (void)val;
+    sched_yield();
+#endif
+}
+
+inline void futex_wake(uint32_t* addr, int num)
+{
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+#else
+    (void)addr;
+    (void)num;
+#endif
+}
+
+/*
+停车用的事件计数，等待方先置位waiting，再读epoch，最后重试一次，失败才在epoch上休眠
+通知方在改变队列状态后读取waiting，置位时清零、推进epoch并唤醒所有等待方，醒来的线程重试失败后再重新置位
+两边都是seq_cst，要么通知方看到waiting，要么等待方的重试看到新状态，不会漏掉唤醒
+只在有线程休眠后的第一次改变时才有系统调用，而不是每次都唤醒，等待方停车之前的重试成功时最多多一次唤醒
+*/
+struct EventCount {
+    uint32_t epoch;
+    uint32_t waiting;
+} RINGQUEUE_ALIGNED;
+
+//登记为等待方，返回之后用来休眠的epoch，调用方接着要重试一次
+inline uint32_t prepare_wait(EventCount* ev)
+{
+    __atomic_store_n(&ev->waiting, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return load_seq_cst(&ev->epoch);
+}
+
+inline void notify(EventCount* ev)
+{
+    if (load_seq_cst(&ev->waiting) && __atomic_exchange_n(&ev->waiting, 0, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&ev->epoch, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&ev->epoch, 0x7FFFFFFF);
+    }
+}
+
+//独占一个缓存行的序列号
+struct PaddedSeq {
+    uint64_t value;
+} RINGQUEUE_ALIGNED;
+
+/*
+WORK_QUEUE的通用实现，每个槽位带一个序列号(Vyukov有界队列)
+槽位序列号等于pos时可写入pos，等于pos + 1时可读取pos，读取后设为pos + Capacity留给下一圈的写入
+Producers或Consumers为SINGLE时那一侧直接前移下标，不需要CAS
+*/
+template <typename T, unsigned Capacity, Cardinality Producers, Cardinality Consumers, Delivery D, unsigned MaxReaders>
+class Ring {
+public:
+    Ring()
+    {
+        for (unsigned i = 0; i < Capacity; i++) {
+            cells_[i].seq = i;
+        }
+        enqueue_.value = 0;
+        dequeue_.value = 0;
+        not_full_.epoch = not_full_.waiting = 0;
+        not_empty_.epoch = not_empty_.waiting = 0;
+    }
+
+    bool try_push(const T& value)
+    {
+        uint64_t pos = load_relaxed(&enqueue_.value);
+        for (;;) {
+            Cell* cell = &cells_[pos & (Capacity - 1)];
+            int64_t diff = (int64_t)(load_acquire(&cell->seq) - pos);
+            if (0 == diff) {
+                if (SINGLE == Producers) {
+                    store_relaxed(&enqueue_.value, pos + 1);
+                } else if (!cas(&enqueue_.value, &pos, pos + 1)) {
+                    continue;//失败时pos已更新为其它生产者申请后的位置
+                }
+                cell->data = value;
+                store_seq_cst(&cell->seq, pos + 1);//和notify中读取waiters构成StoreLoad顺序
+                notify(&not_empty_);
+                return true;
+            }
+            if (diff < 0) {
+                return false;//上一圈的元素还没有被读走
+            }
+            pos = load_relaxed(&enqueue_.value);
+        }
+    }
+
+    bool try_pop(T& value)
+    {
+        uint64_t pos = load_relaxed(&dequeue_.value);
+        for (;;) {
+            Cell* cell = &cells_[pos & (Capacity - 1)];
+            int64_t diff = (int64_t)(load_acquire(&cell->seq) - (pos + 1));
+            if (0 == diff) {
+                if (SINGLE == Consumers) {
+                    store_relaxed(&dequeue_.value, pos + 1);
+                } else if (!cas(&dequeue_.value, &pos, pos + 1)) {
+                    continue;
+                }
+                value = cell->data;
+                store_seq_cst(&cell->seq, pos + Capacity);
+                notify(&not_full_);
+                return true;
+            }
+            if (diff < 0) {
+                return false;
+            }
+            pos = load_relaxed(&dequeue_.value);
+        }
+    }
+
+    //队列满时先自旋再让出CPU，之后在not_full_上停车，直到有消费者取走元素
+    void push(const T& value)
+    {
+        int tries = 0;
+        while (!try_push(value)) {
+            if (tries < spin_tries() + RINGQUEUE_YIELD_TRIES) {
+                backoff(&tries);
+                continue;
+            }
+            uint32_t epoch = prepare_wait(&not_full_);
+            bool ok = try_push(value);
+            if (ok) {
+                return;
+            }
+            futex_wait(&not_full_.epoch, epoch);
+        }
+    }
+
+    //队列空时先自旋再让出CPU，之后在not_empty_上停车，直到有生产者写入元素
+    void pop(T& value)
+    {
+        int tries = 0;
+        while (!try_pop(value)) {
+            if (tries < spin_tries() + RINGQUEUE_YIELD_TRIES) {
+                backoff(&tries);
+                continue;
+            }
+            uint32_t epoch = prepare_wait(&not_empty_);
+            bool ok = try_pop(value);
+            if (ok) {
+                return;
+            }
+            futex_wait(&not_empty_.epoch, epoch);
+        }
+    }
+
+private:
+    struct Cell {
+        uint64_t seq;
+        T data;
+    };
+    PaddedSeq enqueue_;     // 下一个要写入的位置，多生产者时用CAS申请
+    PaddedSeq dequeue_;     // 下一个要读取的位置，多消费者时用CAS申请
+    EventCount not_full_;   // 生产者因队列满而停车，每次读取后检查
+    EventCount not_empty_;  // 消费者因队列空而停车，每次写入后检查
+    Cell cells_[Capacity] RINGQUEUE_ALIGNED;
+};
+
+/*
+单生产者单消费者的WORK_QUEUE(Lamport环形队列)
+两边各自只写自己的下标，并缓存对方的下标，只在按缓存看起来满或空时才重新读取对方的缓存行
+*/
+template <typename T, unsigned Capacity, unsigned MaxReaders>
+class Ring<T, Capacity, SINGLE, SINGLE, WORK_QUEUE, MaxReaders> {
+public:
+    Ring()
+    {
+        producer_.tail = 0;
+        producer_.cached_head = 0;
+        consumer_.head = 0;
+        consumer_.cached_tail = 0;
+    }
+
+    bool try_push(const T& value)
+    {
+        uint64_t tail = producer_.tail;
+        if (tail - producer_.cached_head >= Capacity) {
+            producer_.cached_head = load_acquire(&consumer_.head);
+            if (tail - producer_.cached_head >= Capacity) {
+                return false;
+            }
+        }
+        slots_[tail & (Capacity - 1)] = value;
+        store_release(&producer_.tail, tail + 1);
+        return true;
+    }
+
+    bool try_pop(T& value)
+    {
+        uint64_t head = consumer_.head;
+        if (head >= consumer_.cached_tail) {
+            consumer_.cached_tail = load_acquire(&producer_.tail);
+            if (head >= consumer_.cached_tail) {
+                return false;
+            }
+        }
+        value = slots_[head & (Capacity - 1)];
+        store_release(&consumer_.head, head + 1);
+        return true;
+    }
+
+    void push(const T& value)
+    {
+        int tries = 0;
+        while (!try_push(value)) {
+            backoff(&tries);
+        }
+    }
+
+    void pop(T& value)
+    {
+        int tries = 0;
+        while (!try_pop(value)) {
+            backoff(&tries);
+        }
+    }
+
+private:
+    //每一侧写的下标和它缓存的对方下标在同一个缓存行，两侧之间不共享缓存行
+    struct {
+        uint64_t tail;          // 下一个要写入的位置，只有生产者写
+        uint64_t cached_head;   // 生产者缓存的消费者位置
+    } producer_ RINGQUEUE_ALIGNED;
+    struct {
+        uint64_t head;          // 下一个要读取的位置，只有消费者写
+        uint64_t cached_tail;   // 消费者缓存的生产者位置
+    } consumer_ RINGQUEUE_ALIGNED;
+    T slots_[Capacity] RINGQUEUE_ALIGNED;
+};
+
+/*
+BROADCAST，和spmc2的无锁模式一样，每个读者有自己的序列号，读取和释放都只写自己的缓存行
+生产者缓存最慢读者的位置，只有不够写时才扫描读者表，缓存不超过扫描时的cursor，
+所以没有读者时生产者只受还没发布完的申请限制，之后注册的读者从不小于这个位置的地方开始读取
+单生产者只需要发布cursor，多生产者用CAS申请序列号，乱序写完后在槽位上记录已发布的序列号加1，
+再从cursor开始推进所有连续发布的序列号，cursor之前的序列号都已经写完
+不能用已申请的位置代替cursor: 申请后还没写完的生产者会被套圈，和新申请同一槽位的生产者同时写，
+从已申请位置开始的读者也可能读到旧的数据
+*/
+template <typename T, unsigned Capacity, Cardinality Producers, Cardinality Consumers, unsigned MaxReaders>
+class Ring<T, Capacity, Producers, Consumers, BROADCAST, MaxReaders> {
+public:
+    enum { READER_NUM = (SINGLE == Consumers) ? 1 : MaxReaders };
+
+    Ring()
+    {
+        claim_.next = 0;
+        claim_.cached_gating = 0;
+        cursor_.value = 0;
+        for (unsigned i = 0; i < Capacity; i++) {
+            published_[i] = 0;
+        }
+        for (unsigned i = 0; i < READER_NUM; i++) {
+            readers_[i].value = INACTIVE;
+        }
+    }
+
+    /*
+    用CAS占用一个空闲的读者位置，再从cursor开始读取
+    生产者在占用之前扫描读者表得到的可写下界不超过它当时的cursor，不会超过这里重新读取的cursor，
+    之后的扫描都能看到这个读者，所以从重新读取的位置开始是安全的
+    多生产者时cursor之后可能有已经发布的槽位，读者按槽位上的序列号读取，不会读到cursor之前申请而没写完的槽位
+    */
+    int attach()
+    {
+        for (unsigned i = 0; i < READER_NUM; i++) {
+            uint64_t expected = INACTIVE;
+            if (cas(&readers_[i].value, &expected, published_end())) {
+                store_seq_cst(&readers_[i].value, published_end());
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    void detach(int reader)
+    {
+        store_release(&readers_[reader].value, INACTIVE);
+    }
+
+    bool try_push(const T& value)
+    {
+        uint64_t seq = 0;
+        for (;;) {
+            seq = load_relaxed(&claim_.next);
+            //seq要覆盖的是seq - Capacity，最慢的读者必须已经读过它
+            if (seq >= load_relaxed(&claim_.cached_gating) + Capacity) {
+                uint64_t gate = gating();
+                store_relaxed(&claim_.cached_gating, gate);
+                if (seq >= gate + Capacity) {
+                    return false;
+                }
+            }
+            if (SINGLE == Producers) {
+                store_relaxed(&claim_.next, seq + 1);
+                break;
+            }
+            if (cas(&claim_.next, &seq, seq + 1)) {
+                break;
+            }
+        }
+        slots_[seq & (Capacity - 1)] = value;
+        if (SINGLE == Producers) {
+            store_seq_cst(&cursor_.value, seq + 1);
+        } else {
+            store_seq_cst(&published_[seq & (Capacity - 1)], seq + 1);
+            advance_cursor();
+        }
+        return true;
+    }
+
+    bool try_pop(int reader, T& value)
+    {
+        uint64_t seq = readers_[reader].value;
+        if (!is_published(seq)) {
+            return false;
+        }
+        value = slots_[seq & (Capacity - 1)];
+        store_seq_cst(&readers_[reader].value, seq + 1);
+        return true;
+    }
+
+    void push(const T& value)
+    {
+        int tries = 0;
+        while (!try_push(value)) {
+            backoff(&tries);
+        }
+    }
+
+    void pop(int reader, T& value)
+    {
+        int tries = 0;
+        while (!try_pop(reader, value)) {
+            backoff(&tries);
+        }
+    }
+
+private:
+    static const uint64_t INACTIVE = ~(uint64_t)0;//读者位置空闲
+
+    //新读者开始读取的位置，cursor之前的序列号都已写完，之前的序列号都不交给这个读者
+    uint64_t published_end()
+    {
+        return load_seq_cst(&cursor_.value);
+    }
+
+    /*
+    多生产者从cursor开始推进所有连续发布的序列号，和spmc2的lf_write_batch_data一样
+    标记和推进都用seq_cst，前面的序列号正在推进时，要么推进者看到本槽位的标记，要么本生产者看到新的cursor
+    */
+    void advance_cursor()
+    {
+        uint64_t cursor = load_seq_cst(&cursor_.value);
+        for (;;) {
+            //上一圈留下的标记不超过cursor
+            uint64_t end = load_seq_cst(&published_[cursor & (Capacity - 1)]);
+            if (end <= cursor) {
+                break;
+            }
+            //失败时cursor被更新为其它生产者推进后的值，继续从那里推进
+            if (cas(&cursor_.value, &cursor, end)) {
+                cursor = end;
+            }
+        }
+    }
+
+    bool is_published(uint64_t seq)
+    {
+        if (SINGLE == Producers) {
+            return seq < load_acquire(&cursor_.value);
+        }
+        return seq + 1 == load_acquire(&published_[seq & (Capacity - 1)]);
+    }
+
+    //最慢读者的位置，不超过cursor，还没写完的申请所在的槽位不会被下一圈的生产者覆盖
+    uint64_t gating()
+    {
+        uint64_t min_seq = published_end();
+        for (unsigned i = 0; i < READER_NUM; i++) {
+            uint64_t seq = load_seq_cst(&readers_[i].value);
+            if (seq < min_seq) {
+                min_seq = seq;
+            }
+        }
+        return min_seq;
+    }
+
+    struct {
+        uint64_t next;          // 下一个要申请的序列号
+        uint64_t cached_gating; // 缓存的最慢读者位置，不超过它时不需要扫描读者表
+    } claim_ RINGQUEUE_ALIGNED;
+    PaddedSeq cursor_;                      // 连续发布的序列号个数，单生产者时所有读者都在轮询
+    PaddedSeq readers_[READER_NUM];         // 每个读者下一个要读取的序列号，空闲时为INACTIVE
+    uint64_t published_[Capacity] RINGQUEUE_ALIGNED; // 多生产者每个槽位上已发布的序列号加1
+    T slots_[Capacity] RINGQUEUE_ALIGNED;
+};
+
+template <typename T, unsigned Capacity, Cardinality Producers, Cardinality Consumers, unsigned MaxReaders>
+const uint64_t Ring<T, Capacity, Producers, Consumers, BROADCAST, MaxReaders>::INACTIVE;
+
+} // namespace detail
+
+template <typename T, unsigned Capacity, Cardinality Producers = SINGLE, Cardinality Consumers = SINGLE,
+    Delivery D = WORK_QUEUE, unsigned MaxReaders = 16>
+class Queue : public detail::Ring<T, Capacity, Producers, Consumers, D, MaxReaders> {
+    enum {
+        capacity_is_power_of_two = detail::StaticCheck<Capacity >= 2 && 0 == (Capacity & (Capacity - 1))>::ok,
+        readers_not_empty = detail::StaticCheck<MaxReaders >= 1>::ok
+    };
+public:
+    static unsigned capacity() { return Capacity; }
+};
+
+/*
+分片的工作队列，通道i的主人是第i个生产者和home为i的消费者
+生产者只写自己的通道，消费者空闲时从home + 1开始依次窃取，窃取的CAS只在被窃取的通道上竞争
+所有通道都空时消费者在not_empty_上停车，生产者写入后检查一次，不需要知道哪个消费者在停车
+*/
+template <typename T, unsigned LaneCapacity, unsigned MaxLanes>
+class ShardedQueue {
+    typedef Queue<T, LaneCapacity, MULTI, MULTI, WORK_QUEUE> Lane;
+    enum { lanes_not_empty = detail::StaticCheck<MaxLanes >= 1>::ok };
+public:
+    explicit ShardedQueue(unsigned lanes) : lane_num_(lanes < 1 ? 1 : (lanes > MaxLanes ? MaxLanes : lanes)), closed_(0)
+    {
+        not_empty_.epoch = not_empty_.waiting = 0;
+    }
+
+    unsigned lanes() const { return lane_num_; }
+
+    bool try_push(unsigned lane, const T& value)
+    {
+        if (!lanes_[lane % lane_num_].try_push(value)) {
+            return false;
+        }
+        detail::notify(&not_empty_);
+        return true;
+    }
+
+    //通道满时在这条通道上等待，不写到其它通道，保持每个生产者的元素都在自己的通道中
+    void push(unsigned lane, const T& value)
+    {
+        lanes_[lane % lane_num_].push(value);
+        detail::notify(&not_empty_);
+    }
+
+    int try_pop(unsigned home, T& value)
+    {
+        for (unsigned i = 0; i < lane_num_; i++) {
+            unsigned lane = (home + i) % lane_num_;
+            if (lanes_[lane].try_pop(value)) {
+                return (int)lane;
+            }
+        }
+        return -1;
+    }
+
+    int pop(unsigned home, T& value)
+    {
+        int tries = 0;
+        for (;;) {
+            int lane = try_pop(home, value);
+            if (lane >= 0) {
+                return lane;
+            }
+            //关闭之后生产者不会再写入，再取一次确认所有通道都已经取完
+            if (detail::load_acquire(&closed_)) {
+                return try_pop(home, value);
+            }
+            if (tries < detail::spin_tries() + RINGQUEUE_YIELD_TRIES) {
+                detail::backoff(&tries);
+                continue;
+            }
+            uint32_t epoch = detail::prepare_wait(&not_empty_);
+            lane = try_pop(home, value);
+            if (lane >= 0) {
+                return lane;
+            }
+            if (detail::load_seq_cst(&closed_)) {
+                continue;
+            }
+            detail::futex_wait(&not_empty_.epoch, epoch);
+        }
+    }
+
+    void close()
+    {
+        detail::store_seq_cst(&closed_, 1);
+        __atomic_add_fetch(&not_empty_.epoch, 1, __ATOMIC_SEQ_CST);
+        detail::futex_wake(&not_empty_.epoch, 0x7FFFFFFF);
+    }
+
+private:
+    Lane lanes_[MaxLanes];      // 每条通道的下标都按缓存行对齐，不同通道之间不共享缓存行
+    unsigned lane_num_;
+    int closed_;
+    detail::EventCount not_empty_; // 所有通道都空时消费者在这里停车
+};
+
+} // namespace ringqueue
+
+#endif
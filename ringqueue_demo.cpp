@@ -0,0 +1,319 @@
+/*
+ringqueue.h的示例，每种生产者/消费者/投递方式的组合各跑一遍，检查结果并输出吞吐量
+元素为 生产者编号 << 40 | 序号，WORK_QUEUE检查每个元素正好被取出一次，单消费者时还检查每个生产者的顺序，
+BROADCAST检查每个读者都按每个生产者的顺序收到了所有元素，
+多生产者的BROADCAST还检查运行中注册的读者和没有读者时生产者套圈的情况
+
+用法: ringqueue_demo [-n items_per_producer]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <new>
+#include "ringqueue.h"
+
+#define PRODUCER_MAX    (4)
+#define CONSUMER_MAX    (4)
+#define QUEUE_CAPACITY  (1024)
+
+using namespace ringqueue;
+
+static int64_t g_items = 1000000;//每个生产者写入的元素个数
+
+template <class Q>
+struct Context {
+    Q queue;
+    int producer_num;
+    int consumer_num;
+    int readers[CONSUMER_MAX];  // BROADCAST时每个消费者的读者编号
+    int64_t consumed;           // WORK_QUEUE已经取出的元素个数，取完后消费者退出
+    uint64_t sum[CONSUMER_MAX]; // 每个消费者取出的元素之和
+    int64_t count[CONSUMER_MAX];
+    int producers_done;         // 已经写完退出的生产者个数
+    bool partial;               // BROADCAST的读者在运行中才注册，只收到一部分元素，不检查总和
+    int errors;
+};
+
+template <class Q>
+struct ThreadArg {
+    Context<Q>* ctx;
+    int id;
+};
+
+template <class Q>
+static void* producer(void* arg)
+{
+    ThreadArg<Q>* a = (ThreadArg<Q>*)arg;
+    for (int64_t i = 0; i < g_items; i++) {
+        a->ctx->queue.push(((uint64_t)a->id << 40) | (uint64_t)i);
+    }
+    __atomic_add_fetch(&a->ctx->producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+//检查同一个生产者的元素是否按顺序到达
+static bool check_order(int64_t* last,uint64_t value)
+{
+    int p = (int)(value >> 40);
+    int64_t seq = (int64_t)(value & (((uint64_t)1 << 40) - 1));
+    bool ok = (seq == last[p] + 1);
+    last[p] = seq;
+    return ok;
+}
+
+template <class Q>
+static void* work_consumer(void* arg)
+{
+    ThreadArg<Q>* a = (ThreadArg<Q>*)arg;
+    Context<Q>* ctx = a->ctx;
+    int64_t total = g_items * ctx->producer_num;
+    int64_t last[PRODUCER_MAX];
+    for (int i = 0; i < PRODUCER_MAX; i++) {
+        last[i] = -1;
+    }
+    uint64_t value = 0;
+    int tries = 0;
+    while (__atomic_load_n(&ctx->consumed, __ATOMIC_RELAXED) < total) {
+        if (!ctx->queue.try_pop(value)) {
+            detail::backoff(&tries);
+            continue;
+        }
+        tries = 0;
+        __atomic_add_fetch(&ctx->consumed, 1, __ATOMIC_RELAXED);
+        ctx->sum[a->id] += value;
+        ctx->count[a->id]++;
+        if (1 == ctx->consumer_num && !check_order(last, value)) {
+            __atomic_add_fetch(&ctx->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+template <class Q>
+static void* broadcast_consumer(void* arg)
+{
+    ThreadArg<Q>* a = (ThreadArg<Q>*)arg;
+    Context<Q>* ctx = a->ctx;
+    int64_t total = g_items * ctx->producer_num;
+    int64_t last[PRODUCER_MAX];
+    for (int i = 0; i < PRODUCER_MAX; i++) {
+        last[i] = -1;
+    }
+    uint64_t value = 0;
+    for (int64_t n = 0; n < total; n++) {
+        ctx->queue.pop(ctx->readers[a->id], value);
+        ctx->sum[a->id] += value;
+        ctx->count[a->id]++;
+        if (!check_order(last, value)) {
+            __atomic_add_fetch(&ctx->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+    ctx->queue.detach(ctx->readers[a->id]);
+    return NULL;
+}
+
+/*
+生产者开始之后才注册的读者，注册之前没有读者限制生产者，生产者一直在套圈
+每个生产者的元素必须按顺序、连续地收到最后一个，注册时已经写完的生产者可以一个也收不到
+生产者都写完之后再取不到元素就结束
+*/
+template <class Q>
+static void* late_consumer(void* arg)
+{
+    ThreadArg<Q>* a = (ThreadArg<Q>*)arg;
+    Context<Q>* ctx = a->ctx;
+    usleep(1000 * (a->id + 1));//每个读者在不同的时刻注册
+    int reader = ctx->queue.attach();
+    int64_t last[PRODUCER_MAX];
+    for (int i = 0; i < PRODUCER_MAX; i++) {
+        last[i] = -1;
+    }
+    uint64_t value = 0;
+    int tries = 0;
+    for (;;) {
+        //先看生产者是否都已退出再取，退出前写入的元素都已发布，这时取不到就是读完了
+        bool bDone = (ctx->producer_num == __atomic_load_n(&ctx->producers_done, __ATOMIC_ACQUIRE));
+        if (!ctx->queue.try_pop(reader, value)) {
+            if (bDone) {
+                break;
+            }
+            detail::backoff(&tries);
+            continue;
+        }
+        tries = 0;
+        int p = (int)(value >> 40);
+        int64_t seq = (int64_t)(value & (((uint64_t)1 << 40) - 1));
+        if (last[p] >= 0 && seq != last[p] + 1) {
+            __atomic_add_fetch(&ctx->errors, 1, __ATOMIC_RELAXED);
+        }
+        last[p] = seq;
+        ctx->count[a->id]++;
+    }
+    for (int p = 0; p < ctx->producer_num; p++) {
+        if (last[p] >= 0 && last[p] != g_items - 1) {
+            __atomic_add_fetch(&ctx->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+    ctx->queue.detach(reader);
+    return NULL;
+}
+
+/*
+生产者都写完之后才注册的读者，整个运行期间没有读者，生产者不受限制地套圈
+所有申请都已发布时新读者从最后一个元素之后开始，取不到旧元素，自己写入的探测值能马上读到
+*/
+template <class Q>
+static void* idle_consumer(void* arg)
+{
+    ThreadArg<Q>* a = (ThreadArg<Q>*)arg;
+    Context<Q>* ctx = a->ctx;
+    int tries = 0;
+    while (ctx->producer_num != __atomic_load_n(&ctx->producers_done, __ATOMIC_ACQUIRE)) {
+        detail::backoff(&tries);
+    }
+    const uint64_t probe = ~(uint64_t)0;
+    int reader = ctx->queue.attach();
+    uint64_t value = 0;
+    bool ok = !ctx->queue.try_pop(reader, value);
+    ctx->queue.push(probe);
+    ok = ok && ctx->queue.try_pop(reader, value) && probe == value;
+    if (!ok) {
+        __atomic_add_fetch(&ctx->errors, 1, __ATOMIC_RELAXED);
+    }
+    ctx->queue.detach(reader);
+    return NULL;
+}
+
+//读者在生产者开始之前注册，才能收到所有元素
+template <class Q>
+static void attach_readers(Context<Q>* ctx)
+{
+    for (int i = 0; i < ctx->consumer_num; i++) {
+        ctx->readers[i] = ctx->queue.attach();
+    }
+}
+
+//读者由late_consumer/idle_consumer自己注册
+template <class Q>
+static void attach_later(Context<Q>* ctx)
+{
+    ctx->partial = true;
+}
+
+//所有生产者写入的元素之和
+static uint64_t expected_sum(int producer_num)
+{
+    uint64_t sum = 0;
+    for (int p = 0; p < producer_num; p++) {
+        sum += ((uint64_t)p << 40) * (uint64_t)g_items + (uint64_t)g_items * (uint64_t)(g_items - 1) / 2;
+    }
+    return sum;
+}
+
+/*
+运行一种组合，attach为NULL时是WORK_QUEUE，否则为BROADCAST，在启动线程之前注册读者
+两种投递方式的接口不同，只实例化对应的消费者函数
+*/
+template <class Q>
+static int run(const char* name,int producer_num,int consumer_num,void* (*consume)(void*),void (*attach)(Context<Q>*))
+{
+    bool bBroadcast = (NULL != attach);
+    //队列中的下标按缓存行对齐，C++17之前new不保证这样的对齐
+    void* mem = NULL;
+    if (0 != posix_memalign(&mem, RINGQUEUE_CACHE_LINE, sizeof(Context<Q>))) {
+        return 1;
+    }
+    Context<Q>* ctx = new (mem) Context<Q>();
+    ctx->producer_num = producer_num;
+    ctx->consumer_num = consumer_num;
+    ctx->consumed = 0;
+    ctx->producers_done = 0;
+    ctx->partial = false;
+    ctx->errors = 0;
+    memset(ctx->sum, 0, sizeof(ctx->sum));
+    memset(ctx->count, 0, sizeof(ctx->count));
+    if (bBroadcast) {
+        attach(ctx);
+    }
+    pthread_t producerIds[PRODUCER_MAX];
+    pthread_t consumerIds[CONSUMER_MAX];
+    ThreadArg<Q> producerArgs[PRODUCER_MAX];
+    ThreadArg<Q> consumerArgs[CONSUMER_MAX];
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (int i = 0; i < consumer_num; i++) {
+        consumerArgs[i].ctx = ctx;
+        consumerArgs[i].id = i;
+        pthread_create(&consumerIds[i], NULL, consume, &consumerArgs[i]);
+    }
+    for (int i = 0; i < producer_num; i++) {
+        producerArgs[i].ctx = ctx;
+        producerArgs[i].id = i;
+        pthread_create(&producerIds[i], NULL, producer<Q>, &producerArgs[i]);
+    }
+    for (int i = 0; i < producer_num; i++) {
+        pthread_join(producerIds[i], NULL);
+    }
+    for (int i = 0; i < consumer_num; i++) {
+        pthread_join(consumerIds[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double elapsed = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+
+    uint64_t expected = expected_sum(producer_num);
+    uint64_t sum = 0;
+    int64_t count = 0;
+    for (int i = 0; i < consumer_num; i++) {
+        if (bBroadcast && !ctx->partial && (ctx->sum[i] != expected || ctx->count[i] != g_items * producer_num)) {
+            ctx->errors++;
+        }
+        sum += ctx->sum[i];
+        count += ctx->count[i];
+    }
+    if (!bBroadcast && (sum != expected || count != g_items * producer_num)) {
+        ctx->errors++;
+    }
+    printf("%-28s %dP%dC %10.0f items/s %s\n", name, producer_num, consumer_num,
+        g_items * producer_num / elapsed, ctx->errors ? "FAILED" : "ok");
+    int errors = ctx->errors;
+    ctx->~Context<Q>();
+    free(mem);
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            g_items = atoll(optarg);
+            break;
+        default:
+            printf("usage: %s [-n items_per_producer]\n", argv[0]);
+            return -1;
+        }
+    }
+    typedef Queue<uint64_t, QUEUE_CAPACITY, SINGLE, SINGLE, WORK_QUEUE> WorkSpsc;
+    typedef Queue<uint64_t, QUEUE_CAPACITY, MULTI, SINGLE, WORK_QUEUE> WorkMpsc;
+    typedef Queue<uint64_t, QUEUE_CAPACITY, SINGLE, MULTI, WORK_QUEUE> WorkSpmc;
+    typedef Queue<uint64_t, QUEUE_CAPACITY, MULTI, MULTI, WORK_QUEUE> WorkMpmc;
+    typedef Queue<uint64_t, QUEUE_CAPACITY, SINGLE, SINGLE, BROADCAST> BroadcastSpsc;
+    typedef Queue<uint64_t, QUEUE_CAPACITY, SINGLE, MULTI, BROADCAST, CONSUMER_MAX> BroadcastSpmc;
+    typedef Queue<uint64_t, QUEUE_CAPACITY, MULTI, MULTI, BROADCAST, CONSUMER_MAX> BroadcastMpmc;
+    int errors = 0;
+    errors += run<WorkSpsc>("work spsc (lamport)", 1, 1, work_consumer<WorkSpsc>, NULL);
+    errors += run<WorkMpsc>("work mpsc", 2, 1, work_consumer<WorkMpsc>, NULL);
+    errors += run<WorkSpmc>("work spmc", 1, 3, work_consumer<WorkSpmc>, NULL);
+    errors += run<WorkMpmc>("work mpmc", 2, 3, work_consumer<WorkMpmc>, NULL);
+    errors += run<BroadcastSpsc>("broadcast single reader", 1, 1, broadcast_consumer<BroadcastSpsc>, attach_readers<BroadcastSpsc>);
+    errors += run<BroadcastSpmc>("broadcast sp", 1, 3, broadcast_consumer<BroadcastSpmc>, attach_readers<BroadcastSpmc>);
+    errors += run<BroadcastMpmc>("broadcast mp", 2, 3, broadcast_consumer<BroadcastMpmc>, attach_readers<BroadcastMpmc>);
+    errors += run<BroadcastMpmc>("broadcast mp late readers", 3, 2, late_consumer<BroadcastMpmc>, attach_later<BroadcastMpmc>);
+    errors += run<BroadcastMpmc>("broadcast mp no readers", 3, 1, idle_consumer<BroadcastMpmc>, attach_later<BroadcastMpmc>);
+    return errors ? 1 : 0;
+}
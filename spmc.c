@@ -1,8 +1,33 @@
+/*
+有界缓冲区的多生产者多消费者示例，三种模式
+mutex     一把锁保护write_idx/read_idx/count，非满和非空两个条件变量，所有生产者和消费者竞争同一把锁
+lockfree  ringqueue.h中每个槽位带序列号的有界队列，生产者和消费者只用CAS申请各自的下标，互不阻塞，
+          只有队列满或空时才停车
+sharded   ringqueue.h的分片队列，每个生产者一条通道，消费者i先取通道i % 生产者个数，空了再从其它通道窃取，
+          所有通道都空时才停车，没有窃取时每条通道只在它的生产者和主人消费者之间传递缓存行
+
+不指定-n时和原来一样一直运行并打印每个元素，指定-n时每个生产者写入n个元素后，
+mutex和lockfree的每个消费者收到一个结束标记(元素0)退出，sharded关闭队列，消费者取完所有通道后退出，
+最后检查所有元素之和并输出吞吐量，sharded还输出窃取的元素个数
+
+用法: spmc [-m mutex|lockfree|sharded] [-p producers] [-c consumers] [-n items_per_producer] [-q]
+    -q 不打印每个元素，用来比较各种模式的吞吐量
+*/
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <new>
+#include "ringqueue.h"
 
-#define BUFFER_SIZE 10
+#define BUFFER_SIZE 10//mutex模式的缓冲区大小
+#define QUEUE_CAPACITY 16//lockfree的容量和sharded每条通道的容量，必须是2的幂
+#define PRODUCER_MAX 64
+#define CONSUMER_MAX 64
+#define END_ITEM 0//结束标记，生产者写入的元素从1开始
 
 // 循环缓冲区结构体
 typedef struct {
@@ -16,63 +41,166 @@ typedef struct {
     pthread_cond_t empty;  // 缓冲区空条件变量
 } BoundedBuffer;
 
+typedef ringqueue::Queue<int, QUEUE_CAPACITY, ringqueue::MULTI, ringqueue::MULTI> LockFreeQueue;
+typedef ringqueue::ShardedQueue<int, QUEUE_CAPACITY, PRODUCER_MAX> ShardedQueue;
+
+#define MODE_MUTEX    (0)
+#define MODE_LOCKFREE (1)
+#define MODE_SHARDED  (2)
+
 BoundedBuffer g_buffer;
+LockFreeQueue* g_queue = NULL;//-m lockfree时使用
+ShardedQueue* g_sharded = NULL;//-m sharded时使用
+static int g_mode = MODE_MUTEX;
+static bool g_quiet = false;
+static long g_items = 0;//每个生产者写入的元素个数，0代表一直运行
+static uint64_t g_sum[CONSUMER_MAX];//每个消费者取出的元素之和
+static long g_count[CONSUMER_MAX];//每个消费者取出的元素个数
+static long g_steals[CONSUMER_MAX];//sharded时每个消费者从其它通道窃取的元素个数
+
+//id为生产者编号，sharded时写入它自己的通道
+void buffer_put(long id, int item) {
+    if (MODE_LOCKFREE == g_mode) {
+        g_queue->push(item);
+        return;
+    }
+    if (MODE_SHARDED == g_mode) {
+        g_sharded->push((unsigned)id, item);
+        return;
+    }
+    pthread_mutex_lock(&g_buffer.lock);
+
+    // 等待缓冲区非满
+    while (g_buffer.count == g_buffer.size) {
+        pthread_cond_wait(&g_buffer.full, &g_buffer.lock);
+    }
+
+    // 写入数据到缓冲区
+    g_buffer.buffer[g_buffer.write_idx] = item;
+    g_buffer.write_idx = (g_buffer.write_idx + 1) % g_buffer.size;
+    g_buffer.count++;
+
+    // 唤醒一个消费者
+    pthread_cond_signal(&g_buffer.empty);
+
+    pthread_mutex_unlock(&g_buffer.lock);
+}
+
+//id为消费者编号，取到结束标记或者sharded的队列关闭并取完时返回false
+bool buffer_get(long id, int* item) {
+    if (MODE_LOCKFREE == g_mode) {
+        g_queue->pop(*item);
+        return *item != END_ITEM;
+    }
+    if (MODE_SHARDED == g_mode) {
+        unsigned home = (unsigned)id % g_sharded->lanes();
+        int lane = g_sharded->pop(home, *item);
+        if (lane < 0) {
+            return false;
+        }
+        if ((unsigned)lane != home) {
+            g_steals[id]++;
+        }
+        return true;
+    }
+    pthread_mutex_lock(&g_buffer.lock);
+
+    // 等待缓冲区非空
+    while (g_buffer.count == 0) {
+        pthread_cond_wait(&g_buffer.empty, &g_buffer.lock);
+    }
+
+    // 读取数据
+    *item = g_buffer.buffer[g_buffer.read_idx];
+    g_buffer.read_idx = (g_buffer.read_idx + 1) % g_buffer.size;
+    g_buffer.count--;
+
+    // 唤醒生产者
+    pthread_cond_signal(&g_buffer.full);
+
+    pthread_mutex_unlock(&g_buffer.lock);
+    return *item != END_ITEM;
+}
 
 void *producer(void *arg) {
-    int item = 1;
-    while (1) {
-        pthread_mutex_lock(&g_buffer.lock);
-        
-        // 等待缓冲区非满
-        while (g_buffer.count == g_buffer.size) {
-            pthread_cond_wait(&g_buffer.full, &g_buffer.lock);
+    long id = (long)arg;
+    for (long item = 1; g_items == 0 || item <= g_items; item++) {
+        buffer_put(id, (int)item);
+        // 打印放在临界区之外，不延长其它线程等锁的时间
+        if (!g_quiet) {
+            printf("Producer %ld produced item %ld\n", id, item);
         }
-        
-        // 写入数据到缓冲区
-        g_buffer.buffer[g_buffer.write_idx] = item;
-        g_buffer.write_idx = (g_buffer.write_idx + 1) % g_buffer.size;
-        g_buffer.count++;
-        
-        printf("Producer produced item %d\n", item);
-        
-        // 唤醒一个消费者
-        pthread_cond_signal(&g_buffer.empty);
-        
-        pthread_mutex_unlock(&g_buffer.lock);
-        
-        item++;
-    }
-    
+    }
+
     return NULL;
 }
 
 void *consumer(void *arg) {
-    while (1) {
-        pthread_mutex_lock(&g_buffer.lock);
-        
-        // 等待缓冲区非空
-        while (g_buffer.count == 0) {
-            pthread_cond_wait(&g_buffer.empty, &g_buffer.lock);
+    long id = (long)arg;
+    int item = 0;
+    while (buffer_get(id, &item)) {
+        g_sum[id] += item;
+        g_count[id]++;
+        if (!g_quiet) {
+            printf("Consumer %ld consumed item %d\n", id, item);
         }
-        
-        // 读取数据并消费
-        int item = g_buffer.buffer[g_buffer.read_idx];
-        g_buffer.read_idx = (g_buffer.read_idx + 1) % g_buffer.size;
-        g_buffer.count--;
-        
-        printf("Consumer %ld consumed item %d\n", (long)arg, item);
-        
-        // 唤醒生产者
-        pthread_cond_signal(&g_buffer.full);
-        
-        pthread_mutex_unlock(&g_buffer.lock);
-    }
-    
+    }
+
     return NULL;
 }
 
-int main() {
-    // 初始化缓冲区
+int main(int argc, char** argv) {
+    int numProducers = 1;
+    int numConsumers = 3;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "m:p:c:n:q")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (0 == strcmp(optarg, "lockfree")) {
+                g_mode = MODE_LOCKFREE;
+            } else if (0 == strcmp(optarg, "sharded")) {
+                g_mode = MODE_SHARDED;
+            } else if (0 != strcmp(optarg, "mutex")) {
+                printf("unknown mode %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'p':
+            numProducers = atoi(optarg);
+            break;
+        case 'c':
+            numConsumers = atoi(optarg);
+            break;
+        case 'n':
+            g_items = atol(optarg);
+            break;
+        case 'q':
+            g_quiet = true;
+            break;
+        default:
+            printf("usage: %s [-m mutex|lockfree|sharded] [-p producers] [-c consumers] [-n items_per_producer] [-q]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (numProducers < 1 || numProducers > PRODUCER_MAX || numConsumers < 1 || numConsumers > CONSUMER_MAX
+        || g_items < 0 || g_items > 0x7FFFFFFF) {
+        printf("producers must be 1..%d, consumers 1..%d\n", PRODUCER_MAX, CONSUMER_MAX);
+        return -1;
+    }
+
+    // 初始化缓冲区，无锁队列的下标按缓存行对齐，用posix_memalign分配
+    void* mem = NULL;
+    if (MODE_LOCKFREE == g_mode) {
+        if (0 != posix_memalign(&mem, RINGQUEUE_CACHE_LINE, sizeof(LockFreeQueue))) {
+            return -1;
+        }
+        g_queue = new (mem) LockFreeQueue();
+    } else if (MODE_SHARDED == g_mode) {
+        if (0 != posix_memalign(&mem, RINGQUEUE_CACHE_LINE, sizeof(ShardedQueue))) {
+            return -1;
+        }
+        g_sharded = new (mem) ShardedQueue(numProducers);
+    }
     g_buffer.buffer = (int *)malloc(sizeof(int) * BUFFER_SIZE);
     g_buffer.size = BUFFER_SIZE;
     g_buffer.write_idx = 0;
@@ -81,30 +209,69 @@ int main() {
     pthread_mutex_init(&g_buffer.lock, NULL);
     pthread_cond_init(&g_buffer.full, NULL);
     pthread_cond_init(&g_buffer.empty, NULL);
-    
-    // 创建生产者线程
-    pthread_t producerThreadId;
-    pthread_create(&producerThreadId, NULL, producer, NULL);
-    
+
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    // 创建多个生产者线程
+    pthread_t producerThreadIds[PRODUCER_MAX];
+    for (long i = 0; i < numProducers; i++) {
+        pthread_create(&producerThreadIds[i], NULL, producer, (void *)i);
+    }
+
     // 创建多个消费者线程
-    int numConsumers = 3;
-    pthread_t consumerThreadIds[numConsumers];
+    pthread_t consumerThreadIds[CONSUMER_MAX];
     for (long i = 0; i < numConsumers; i++) {
         pthread_create(&consumerThreadIds[i], NULL, consumer, (void *)i);
     }
-    
-    // 等待生产者和消费者线程结束
-    pthread_join(producerThreadId, NULL);
+
+    // 生产者都写完后给每个消费者一个结束标记(sharded关闭队列)，再等待消费者线程结束
+    for (int i = 0; i < numProducers; i++) {
+        pthread_join(producerThreadIds[i], NULL);
+    }
+    if (MODE_SHARDED == g_mode) {
+        g_sharded->close();
+    } else {
+        for (int i = 0; i < numConsumers; i++) {
+            buffer_put(i, END_ITEM);
+        }
+    }
     for (int i = 0; i < numConsumers; i++) {
         pthread_join(consumerThreadIds[i], NULL);
     }
-    
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double elapsed = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+
+    uint64_t sum = 0;
+    long count = 0;
+    long steals = 0;
+    for (int i = 0; i < numConsumers; i++) {
+        sum += g_sum[i];
+        count += g_count[i];
+        steals += g_steals[i];
+    }
+    uint64_t expected = (uint64_t)numProducers * (uint64_t)g_items * (uint64_t)(g_items + 1) / 2;
+    bool ok = (sum == expected && count == numProducers * g_items);
+    static const char* modeNames[] = {"mutex", "lockfree", "sharded"};
+    printf("%s %dP%dC: %ld items in %.3f s, %.0f items/s", modeNames[g_mode],
+        numProducers, numConsumers, count, elapsed, count / elapsed);
+    if (MODE_SHARDED == g_mode) {
+        printf(", %ld stolen", steals);
+    }
+    printf(" %s\n", ok ? "ok" : "FAILED");
+
     // 销毁互斥锁和条件变量，释放缓冲区内存
     pthread_mutex_destroy(&g_buffer.lock);
     pthread_cond_destroy(&g_buffer.full);
     pthread_cond_destroy(&g_buffer.empty);
     free(g_buffer.buffer);
-    
-    return 0;
+    if (g_queue) {
+        g_queue->~LockFreeQueue();
+    }
+    if (g_sharded) {
+        g_sharded->~ShardedQueue();
+    }
+    free(mem);
+
+    return ok ? 0 : 1;
 }
-
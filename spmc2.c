@@ -9,6 +9,17 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <inttypes.h>
+#include "loghist.h"
 
 #define DUMP_RED printf("\033[0;32;31m")
 #define DUMP_YELLOW printf("\033[1;33m")
@@ -24,19 +35,90 @@
 #define DEBUG_PW(msg, args...)        
 #endif
 
-#define BUFFER_SIZE (1024)
+#define BUFFER_SIZE (1024)//默认的缓冲区大小，可以用-s修改
 #define MAGIC_NUMBER (0xAACC9527)
-#define CONSUMER_NUM (10)
+#define CONSUMER_NUM (10)//默认的消费者线程个数，可以用-c修改
+#define CONSUMER_DEP_MAX (8)//每个消费者最多依赖的上游消费者个数
 #define DEBUG_MAX_SEQ_NO (10)
 
-static  FILE* g_simulate_fp = NULL;//真实读取到的模拟数据
-static int g_run_flag = 1;//线程运行标识
+//无锁模式下使用的原子操作，生产者发布序列号用release，消费者读取用acquire
+#define LOAD_ACQUIRE(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LOAD_SEQ_CST(p)         __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define STORE_SEQ_CST(p, v)     __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define LOAD_RELAXED(p)         __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE_RELAXED(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+/*
+缓存行大小，被不同线程频繁写入的变量各自独占缓存行
+否则一个消费者前移自己的序列号，就会让生产者和其它消费者正在读的缓存行失效(伪共享)
+*/
+#define CACHE_LINE              (64)
+#define CACHE_ALIGNED           __attribute__((aligned(CACHE_LINE)))
+
+//自旋等待时降低CPU占用和功耗，同时提示CPU这是一个等待循环
+#if defined(__i386__) || defined(__x86_64__)
+#define CPU_RELAX()             __builtin_ia32_pause()
+#elif defined(__arm__) || defined(__aarch64__)
+#define CPU_RELAX()             __asm__ __volatile__("yield" ::: "memory")
+#else
+#define CPU_RELAX()             __asm__ __volatile__("" ::: "memory")
+#endif
+
+//无锁模式下的等待策略，可以为生产者和每个消费者单独配置
+#define WAIT_SPIN       (0)//一直自旋，延迟最低，独占一个CPU，适合绑核的关键消费者
+#define WAIT_YIELD      (1)//自旋一段时间后让出CPU
+#define WAIT_PARK       (2)//自旋一段时间后在futex上停车，适合批量落盘的消费者
+#define WAIT_ADAPTIVE   (3)//自旋一段时间，再让出CPU一段时间，最后停车
+#define WAIT_SPIN_TRIES     (1000)//自旋阶段的次数
+#define WAIT_YIELD_TRIES    (100)//让出CPU阶段的次数
+
+#define URING_DEPTH     (32)//io_uring输出时每个消费者最多同时在写的批次个数
+
+//变长记录模式，环按VAR_UNIT字节的槽位计算序列号，每条记录以VarRecord开头，占用整数个槽位
+#define VAR_UNIT        (8)
+#define VAR_DATA        (0)//数据记录
+#define VAR_PAD         (1)//填充记录，环末尾放不下下一条记录时填满到末尾，消费者直接跳过
+#define VAR_VIEW_MAX    (64)//变长模式下消费者一次最多取出的记录条数
+
+//消费者跟不上生产者时的处理策略，可以为每个消费者单独配置
+#define OVERRUN_BLOCK   (0)//阻塞生产者，不丢数据，最慢的消费者决定所有人的速度
+#define OVERRUN_LOSSY   (1)//不阻塞生产者，被套圈时记录丢失的记录数，再跳到最新的记录继续读取
+
+//缓冲区工作模式
+#define MODE_MUTEX      (0)//互斥锁+条件变量，所有读写都串行在g_buffer->lock上
+#define MODE_LOCK_FREE  (1)//无锁广播模式，生产者发布64位序列号，每个消费者推进自己的序列号
+
 static char g_output_dir[128] = {0};//模拟测试文件路径
 static int g_simulate_rollback = 0;//读取结束后是否重头读取模拟文件,0代表不回头，1代表重头读取模拟
-static int g_seqNo = 0;//模拟数据序列号
-static int g_lastSeqNo[CONSUMER_NUM] = {0};//保存上次包序号，用于debug
-static sem_t g_produceSema;
-static sem_t g_consumerSema[CONSUMER_NUM];
+static int g_mode = MODE_MUTEX;//缓冲区工作模式
+static int64_t g_max_records = 0;//生产的记录总数，0代表一直生产
+static int g_batch_size = 1;//生产者一次申请和发布的最大记录数
+static int g_producer_wait = WAIT_PARK;//生产者的等待策略
+static int g_producer_num = 1;//生产者线程个数，大于1时为多生产者模式
+static int g_producer_running = 0;//还在运行的生产者个数，最后一个退出的生产者通知消费者退出
+static int* g_consumer_wait = NULL;//每个消费者线程的等待策略
+static int* g_consumer_policy = NULL;//每个消费者线程的套圈策略
+static int* g_consumer_delay = NULL;//每个消费者线程处理完一批后额外休眠的微秒数，用来模拟慢速落盘
+static int* g_consumer_deps = NULL;//每个消费者线程依赖的上游消费者线程，每个线程CONSUMER_DEP_MAX个
+static int* g_consumer_dep_num = NULL;//每个消费者线程依赖的上游个数
+static int* g_thread_consumer = NULL;//每个消费者线程当前注册的消费者编号，未注册时为-1
+static int g_buffer_size = BUFFER_SIZE;//缓冲区大小
+static int g_consumer_num = CONSUMER_NUM;//消费者线程个数
+static int g_consumer_max = 0;//最多同时注册的消费者个数，0代表与消费者线程个数相同
+static int64_t g_consumer_lifetime = 0;//消费者读取多少条记录后注销再重新注册，0代表一直不注销
+static bool g_uring_output = false;//消费者是否用io_uring异步写文件
+static char g_shm_name[128] = {0};//共享内存的名字，为空时缓冲区在本进程的堆上
+static bool g_shm_attach = false;//是否只作为消费者进程注册到其它进程创建的共享内存
+static char g_persist_path[128] = {0};//持久化文件的路径，为空时缓冲区不落盘
+static int64_t g_start_seq = 0;//本次运行开始时的cursor，持久化文件恢复后-n从这里开始计数
+static int g_var_max = 0;//变长记录模式下单条记录的最大字节数，0代表定长MyData模式
+static int64_t g_var_claimed = 0;//变长模式下所有生产者已经领取的记录编号，-n限制的是记录条数
+static int64_t g_var_produced = 0;//变长模式下已经发布的记录条数
+static bool g_latency = false;//是否统计每条记录从发布到消费的延迟
+static bool g_wait_stats = false;//是否统计每个线程的等待和g_buffer->lock的持有时间
+static int g_stats_exit = 0;//通知统计输出的信号线程退出
+static sem_t g_produceSema;//消费者第一次注册后通知生产者
 
 typedef struct{
     int magic;
@@ -44,244 +126,2432 @@ typedef struct{
     int count;
     int write_idx;       // 生产者写入位置
     int read_idx;      // 消费者读取位置
+    int64_t publish_ns;  // -L时生产者发布前写入的CLOCK_MONOTONIC纳秒，0代表没有统计延迟
 }MyData;
 
-// 循环缓冲区结构体
+//变长记录的头部，后面紧跟length字节的数据，整条记录向上对齐到VAR_UNIT
+typedef struct {
+    int length;          // 数据的字节数，不包括头部
+    int type;            // VAR_DATA或VAR_PAD
+    int64_t publish_ns;  // 和MyData.publish_ns相同
+} VarRecord;
+
+//消费者读到的一条变长记录，直接指向环中的数据，释放之前一直有效
+typedef struct {
+    const char* data;
+    int length;
+    int64_t seq;         // 记录头部所在的序列号
+    int64_t publish_ns;
+} VarView;
+
+//变长记录占用的槽位个数
+int var_units(int length)
+{
+    return (int)((sizeof(VarRecord) + length + VAR_UNIT - 1) / VAR_UNIT);
+}
+
+#define CONSUMER_FREE   (0)//消费者表中的空闲位置
+#define CONSUMER_ACTIVE (1)//已注册的消费者
+
+//每个消费者的状态，消费者可以在生产者运行时注册和注销，被本消费者频繁写入的字段放在最前面
+typedef struct {
+    int park;             // 无锁模式的futex停车字，0代表运行，1代表已停车
+    int gating_busy;      // 无锁模式下正在更新gating树时为奇数，注册时用来等待其它消费者的更新完成
+    int64_t read_seq;     // 下一个要释放的序列号，只有对应的消费者写入，未注册时为INT64_MAX，不再限制生产者
+    int64_t fetch_seq;    // 无锁模式下一个要读取的序列号，异步输出时可以领先read_seq，读取和释放分开
+    int state;            // CONSUMER_FREE或CONSUMER_ACTIVE，只在g_buffer->lock保护下修改
+    pid_t owner;          // 注册这个消费者的进程，进程崩溃后由生产者回收
+    int wait_strategy;    // 无锁模式下的等待策略
+    int policy;           // 套圈策略，OVERRUN_LOSSY的消费者不参与gating，在read_seq之前写入
+    int read_idx;         // 互斥模式下的读取位置
+    int64_t lapped_num;   // 有损消费者被套圈的次数
+    int64_t lost_num;     // 有损消费者因为套圈跳过的记录数
+    int64_t resume_seq;   // 持久化文件中上次运行留下的read_seq，-1代表没有，只在恢复和退出时注销时写入
+    MyData* copy;         // 无锁模式下有损消费者的读取副本，校验没有被覆盖后才交给调用者
+    int dep_num;          // 依赖的上游消费者个数，0代表直接读取生产者发布的数据
+    int deps[CONSUMER_DEP_MAX]; // 上游消费者编号，只能读取所有上游都已释放的槽位
+    int dependent_num;    // 依赖本消费者的下游个数，大于0时释放后要唤醒下游
+} CACHE_ALIGNED ConsumerCursor; //按缓存行对齐，每个消费者的序列号不和相邻的消费者共享缓存行
+
+#define SHM_MAGIC (0x53504D43)//共享内存初始化完成后写入的魔数
+
+/*
+循环缓冲区结构体，所有数组都和结构体一起分配在一块连续内存中
+使用共享内存时这块内存映射到所有进程的同一个地址，结构体中的指针在所有进程中都有效
+*/
+//独占一个缓存行的序列号和停车字，用于gating树的节点和生产者的停车字
+typedef struct {
+    int64_t value;
+} CACHE_ALIGNED PaddedSeq;
+
+typedef struct {
+    int value;
+} CACHE_ALIGNED PaddedInt;
+
 typedef struct {
+    //初始化后只读的部分，所有线程共享同一个缓存行，不会互相失效
+    int magic;             // 初始化完成后为SHM_MAGIC
+    int run_flag;          // 线程运行标识，共享内存时也通知其它进程的消费者退出，只在退出时写入一次
+    void* base;            // 整块内存的地址，共享内存的其它进程映射到同一地址
+    size_t length;         // 整块内存的大小
+    int producer_num;      // 生产者个数
+    int var_max;           // 变长记录模式下单条记录的最大字节数，0代表定长模式，注册共享内存的进程据此切换模式
+    bool bShared;          // 是否在共享内存中，锁和futex都要跨进程
+    bool bPersist;         // 是否映射自持久化文件，进程崩溃或重启后cursor和消费者位置都可以恢复
     MyData *buffer;  // 缓冲区数据
     int size;     // 缓冲区大小
-    int write_idx;       // 生产者写入位置
-    int read_idx[CONSUMER_NUM];      // 消费者读取位置
-    pthread_mutex_t lock;  // 互斥锁
+    int consumer_max;    // 消费者表的大小
+    ConsumerCursor *consumers; // 消费者表，下标就是消费者编号，每个消费者独占自己的缓存行
+    int *buf_used_count;  // 缓冲区每个MyData数据被使用的记数，用于优化减少判断，空间换时间
+
+    //互斥模式的状态，都在锁的保护下读写，和无锁模式的热点分开
+    pthread_mutex_t lock CACHE_ALIGNED;  // 互斥锁，无锁模式下只用于串行化消费者的注册和注销
     pthread_cond_t full;   // 缓冲区满条件变量
     pthread_cond_t empty;  // 缓冲区空条件变量
-    
-    int *buf_used_count;  // 缓冲区每个MyData数据被使用的记数，用于优化减少判断，空间换时间
+    pthread_mutex_t producer_lock; // 互斥模式的多生产者锁，从申请写入位置一直持有到发布
+    int write_idx;       // 生产者写入位置
+
+    //以下为无锁模式使用，序列号只增不减，对应的槽位为 序列号 % size
+    //生产者申请用的状态独占一个缓存行，只有生产者之间和有损消费者会访问
+    int64_t next_seq CACHE_ALIGNED; // 下一个要申请的序列号，先公开再写数据，有损消费者用来检测是否被套圈
+    int64_t cached_gating;// 生产者缓存的可写下界，不超过根节点和cursor，只有不够写时才重新读取，多生产者共用
+    //所有消费者都在轮询cursor，生产者申请时不能让它失效
+    int64_t cursor CACHE_ALIGNED; // 已发布的序列号个数，小于cursor的序列号都可读
+    /*
+    多生产者模式下，生产者用CAS从next_seq申请一段序列号，写完后乱序发布
+    published[批次第一个槽位] = 批次的结束序列号，发布后所有生产者都可以帮忙推进cursor，
+    cursor只会推进到连续发布的位置，消费者不需要关心生产者个数
+    */
+    int64_t *published;
+
+    /*
+    最慢消费者跟踪(gating)，两种模式共用
+    以read_seq为叶子的最小值锦标赛树，gating_node[1]为根，节点n的子节点为2n和2n+1，
+    下标大于等于gating_leaf_num的子节点就是consumers[子节点 - gating_leaf_num].read_seq
+    消费者前移时只更新自己到根的路径，生产者只读根节点，判断是否可写与消费者个数无关
+    每个节点独占一个缓存行，更新不同子树的消费者不会互相失效
+    */
+    int gating_leaf_num;  // 叶子个数，不小于consumer_max的2的幂
+    PaddedSeq *gating_node; // 树的内部节点，大小为gating_leaf_num
+
+    /*
+    无锁模式的等待层，每个线程在自己的futex字上停车(消费者的停车字为consumers[i].park)
+    生产者发布后只唤醒已停车的消费者，parked_num为0时不需要任何系统调用
+    消费者停车时写入parked_num，生产者每次发布都要读取，不能和cursor在同一个缓存行
+    */
+    int parked_num CACHE_ALIGNED; // 已停车的消费者个数
+    PaddedInt *producer_park;   // 每个生产者因缓冲区满而停车的停车字
 } BoundedBuffer;
 
-BoundedBuffer g_buffer;
+BoundedBuffer* g_buffer = NULL;
+
+//读取树节点的值，叶子就是消费者的read_seq，不存在的消费者不参与比较
+int64_t gating_node_value(int node)
+{
+	if(node < g_buffer->gating_leaf_num)
+	{
+		return LOAD_SEQ_CST(&g_buffer->gating_node[node].value);
+	}
+	int consumerId = node - g_buffer->gating_leaf_num;
+	if(consumerId >= g_buffer->consumer_max)
+	{
+		return INT64_MAX;
+	}
+	//policy在read_seq之前写入，读到注册后的read_seq时一定也能读到注册时的policy
+	int64_t seq = LOAD_SEQ_CST(&g_buffer->consumers[consumerId].read_seq);
+	if(OVERRUN_LOSSY == LOAD_SEQ_CST(&g_buffer->consumers[consumerId].policy))
+	{
+		return INT64_MAX;
+	}
+	return seq;
+}
+
+/*
+消费者的read_seq前移后，沿着到根的路径重新计算最小值
+叶子只增不减，所以任何时刻计算出的值都不会超过真实的最小值，最多偏小，不会让生产者覆盖未读数据
+写入后重新读取子节点，如果子节点又变化了则重算，保证最后一次写入的值是最新的，生产者不会永远等待
+某一层的值没有变化时，更上层也不会因为本次前移而变化，直接返回，bFull为true时一直更新到根
+注册新消费者时叶子会变小，由consumer_attach保证不会有其它消费者用旧的叶子算出偏大的值
+*/
+void gating_propagate(int consumerId,bool bFull)
+{
+	int node = (g_buffer->gating_leaf_num + consumerId) >> 1;
+	for (; node >= 1; node >>= 1)
+	{
+		int64_t left = gating_node_value(node << 1);
+		int64_t right = gating_node_value((node << 1) + 1);
+		int64_t min_seq = left < right ? left : right;
+		if(!bFull && LOAD_SEQ_CST(&g_buffer->gating_node[node].value) == min_seq)
+		{
+			return;
+		}
+		for (;;)
+		{
+			STORE_SEQ_CST(&g_buffer->gating_node[node].value, min_seq);
+			left = gating_node_value(node << 1);
+			right = gating_node_value((node << 1) + 1);
+			int64_t latest = left < right ? left : right;
+			if(latest == min_seq)
+			{
+				break;
+			}
+			min_seq = latest;
+		}
+	}
+}
+
+//更新consumerId到根的路径，无锁模式下用gating_busy标记正在更新
+void gating_update(int consumerId)
+{
+	ConsumerCursor* c = &g_buffer->consumers[consumerId];
+	STORE_SEQ_CST(&c->gating_busy, c->gating_busy + 1);
+	gating_propagate(consumerId, false);
+	STORE_RELEASE(&c->gating_busy, c->gating_busy + 1);
+}
+
+//最慢的那个消费者的read_seq，没有注册的消费者时为INT64_MAX
+int64_t gating_min()
+{
+	return LOAD_ACQUIRE(&g_buffer->gating_node[1].value);
+}
+
+//初始化树，此时还没有注册的消费者，叶子个数和节点数组由buffer_layout设置
+void gating_init()
+{
+	for (int node = g_buffer->gating_leaf_num - 1; node >= 1; node--)
+	{
+		int64_t left = gating_node_value(node << 1);
+		int64_t right = gating_node_value((node << 1) + 1);
+		g_buffer->gating_node[node].value = left < right ? left : right;
+	}
+	g_buffer->gating_node[0].value = 0;
+	g_buffer->cached_gating = 0;
+}
+
+
+//按64字节对齐，各个数组不和前一个数组共享缓存行
+static size_t layout_align(size_t offset)
+{
+	return (offset + 63) & ~(size_t)63;
+}
+
+/*
+计算缓冲区结构体和所有数组在一块连续内存中的布局，返回总大小
+b不为NULL时设置结构体中的数组指针，共享内存时所有进程映射到同一地址，指针可以直接使用
+*/
+size_t buffer_layout(BoundedBuffer* b,int size,int consumer_max,int producer_num)
+{
+	int leaf_num = 2;
+	while (leaf_num < consumer_max)
+	{
+		leaf_num <<= 1;
+	}
+	size_t offset = layout_align(sizeof(BoundedBuffer));
+	size_t buffer_off = offset;
+	//变长模式下buffer按字节使用，每个槽位VAR_UNIT字节
+	offset = layout_align(offset + (g_var_max ? VAR_UNIT : sizeof(MyData)) * size);
+	size_t used_off = offset;
+	offset = layout_align(offset + sizeof(int) * size);
+	size_t published_off = offset;
+	offset = layout_align(offset + sizeof(int64_t) * size);
+	size_t consumers_off = offset;
+	offset = layout_align(offset + sizeof(ConsumerCursor) * consumer_max);
+	size_t gating_off = offset;
+	offset = layout_align(offset + sizeof(PaddedSeq) * leaf_num);
+	size_t park_off = offset;
+	offset = layout_align(offset + sizeof(PaddedInt) * producer_num);
+	if(b)
+	{
+		char* base = (char*)b;
+		b->buffer = (MyData*)(base + buffer_off);
+		b->buf_used_count = (int*)(base + used_off);
+		b->published = (int64_t*)(base + published_off);
+		b->consumers = (ConsumerCursor*)(base + consumers_off);
+		b->gating_node = (PaddedSeq*)(base + gating_off);
+		b->producer_park = (PaddedInt*)(base + park_off);
+		b->gating_leaf_num = leaf_num;
+	}
+	return offset;
+}
+
+//初始化一块全部为0的缓冲区，所有消费者位置都空闲，不限制生产者
+static void buffer_init(BoundedBuffer* b,int size,int consumer_max,int producer_num)
+{
+	buffer_layout(b, size, consumer_max, producer_num);
+	b->run_flag = 1;
+	b->base = b;
+	b->length = buffer_layout(NULL, size, consumer_max, producer_num);
+	b->producer_num = producer_num;
+	b->var_max = g_var_max;
+	b->size = size;
+	b->write_idx = 0;
+	b->next_seq = 0;
+	b->cursor = 0;
+	b->consumer_max = consumer_max;
+	for (int i = 0; i < consumer_max; i++) {
+		b->consumers[i].state = CONSUMER_FREE;
+		b->consumers[i].read_seq = INT64_MAX;
+		b->consumers[i].resume_seq = -1;
+	}
+	g_buffer = b;
+	gating_init();
+	b->parked_num = 0;
+}
+
+/*
+从持久化文件恢复，上次运行留下的停车、gating和依赖状态都已失效，只保留cursor和每个位置的读取进度
+已申请但没有发布的序列号作废，生产者从cursor重新申请，这些槽位可能已被部分覆盖，
+但申请时它们一定已被所有阻塞消费者释放，只有已注销或有损的消费者可能落在这段范围里，把它们推到覆盖范围之后
+*/
+static void buffer_recover(BoundedBuffer* b)
+{
+	int64_t floor = b->next_seq - b->size;
+	b->run_flag = 1;
+	b->next_seq = b->cursor;
+	memset(b->published, 0, sizeof(int64_t) * b->size);
+	memset(b->producer_park, 0, sizeof(PaddedInt) * b->producer_num);
+	for (int i = 0; i < b->consumer_max; i++) {
+		ConsumerCursor* c = &b->consumers[i];
+		if (CONSUMER_ACTIVE == c->state) {
+			c->resume_seq = c->read_seq;//进程崩溃时还在注册的消费者
+		}
+		if (c->resume_seq >= 0 && c->resume_seq < floor) {
+			c->resume_seq = floor;
+		}
+		if (c->resume_seq > b->cursor) {
+			c->resume_seq = b->cursor;
+		}
+		c->state = CONSUMER_FREE;
+		c->read_seq = INT64_MAX;
+		c->policy = OVERRUN_BLOCK;
+		c->park = 0;
+		c->gating_busy = 0;
+		c->copy = NULL;
+		c->dep_num = 0;
+		c->dependent_num = 0;
+	}
+	g_buffer = b;
+	gating_init();
+	b->parked_num = 0;
+}
+
+//初始化锁和条件变量，共享内存时要跨进程，映射持久化文件时上次留下的锁状态无效，每次打开都重新初始化
+static void buffer_sync_init(BoundedBuffer* b)
+{
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	pthread_mutexattr_init(&mattr);
+	pthread_condattr_init(&cattr);
+	if(b->bShared)
+	{
+		pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+		pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+	}
+	pthread_mutex_init(&b->lock, &mattr);
+	pthread_mutex_init(&b->producer_lock, &mattr);
+	pthread_cond_init(&b->full, &cattr);
+	pthread_cond_init(&b->empty, &cattr);
+	pthread_mutexattr_destroy(&mattr);
+	pthread_condattr_destroy(&cattr);
+}
 
-//从3个消费者中找到最小的可写长度
+/*
+创建并初始化缓冲区，shm_name不为空时放在命名共享内存中，其它进程可以用buffer_attach注册消费者
+共享内存时锁和条件变量设置为进程间共享，lock设置为robust，持有锁的进程崩溃后下一个加锁的进程可以恢复
+*/
+BoundedBuffer* buffer_create(const char* shm_name,int size,int consumer_max,int producer_num)
+{
+	size_t length = buffer_layout(NULL, size, consumer_max, producer_num);
+	BoundedBuffer* b = NULL;
+	bool bShared = (shm_name && shm_name[0]);
+	if(bShared)
+	{
+		//上次运行崩溃时留下的同名共享内存直接删除
+		shm_unlink(shm_name);
+		int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0666);
+		if(fd < 0)
+		{
+			DEBUG_PW("shm_open %s failed %s\n", shm_name, strerror(errno));
+			return NULL;
+		}
+		if(ftruncate(fd, length) < 0)
+		{
+			DEBUG_PW("ftruncate %s failed %s\n", shm_name, strerror(errno));
+			close(fd);
+			shm_unlink(shm_name);
+			return NULL;
+		}
+		void* addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if(MAP_FAILED == addr)
+		{
+			DEBUG_PW("mmap %s failed %s\n", shm_name, strerror(errno));
+			shm_unlink(shm_name);
+			return NULL;
+		}
+		//ftruncate出来的内存已经全部为0
+		b = (BoundedBuffer*)addr;
+	}
+	else
+	{
+		//按缓存行对齐，结构体和数组中独占缓存行的字段才真正不和其它数据共享缓存行
+		if(0 != posix_memalign((void**)&b, CACHE_LINE, length))
+		{
+			return NULL;
+		}
+		memset(b, 0, length);
+	}
+	buffer_init(b, size, consumer_max, producer_num);
+	b->bShared = bShared;
+	buffer_sync_init(b);
+	//魔数最后写入，其它进程看到魔数时缓冲区已经初始化完成
+	STORE_RELEASE(&b->magic, SHM_MAGIC);
+	return b;
+}
+
+/*
+打开持久化文件，把整个缓冲区映射到文件上，不存在或大小不符时重新初始化
+文件中已有完整的缓冲区时恢复上次运行的cursor和每个消费者的位置，生产者从cursor继续写入
+*/
+BoundedBuffer* buffer_open_file(const char* path,int size,int consumer_max,int producer_num)
+{
+	size_t length = buffer_layout(NULL, size, consumer_max, producer_num);
+	int fd = open(path, O_RDWR | O_CREAT, 0666);
+	if(fd < 0)
+	{
+		DEBUG_PW("open %s failed %s\n", path, strerror(errno));
+		return NULL;
+	}
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (0 != st.st_size && (size_t)st.st_size != length))
+	{
+		DEBUG_PW("%s does not match buffer size %d, consumers %d, producers %d\n", path, size, consumer_max, producer_num);
+		close(fd);
+		return NULL;
+	}
+	if(0 == st.st_size && ftruncate(fd, length) < 0)
+	{
+		DEBUG_PW("ftruncate %s failed %s\n", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	void* addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(MAP_FAILED == addr)
+	{
+		DEBUG_PW("mmap %s failed %s\n", path, strerror(errno));
+		return NULL;
+	}
+	BoundedBuffer* b = (BoundedBuffer*)addr;
+	//魔数在初始化完成后才写入，初始化到一半崩溃的文件当作新文件
+	if(SHM_MAGIC == b->magic && b->size == size && b->consumer_max == consumer_max && b->producer_num == producer_num
+		&& b->var_max == g_var_max)
+	{
+		buffer_layout(b, size, consumer_max, producer_num);
+		b->base = b;
+		buffer_recover(b);
+		DEBUG_PN("recover %s at cursor %" PRId64 "\n", path, b->cursor);
+	}
+	else
+	{
+		memset(b, 0, length);
+		buffer_init(b, size, consumer_max, producer_num);
+	}
+	b->bPersist = true;
+	buffer_sync_init(b);
+	STORE_RELEASE(&b->magic, SHM_MAGIC);
+	return b;
+}
+
+/*
+注册到其它进程创建的共享内存，先映射结构体读出创建者的地址和大小，再映射整块内存到同一地址
+MAP_FIXED_NOREPLACE保证不会覆盖本进程已有的映射，地址被占用时注册失败
+*/
+BoundedBuffer* buffer_attach(const char* shm_name)
+{
+	int fd = shm_open(shm_name, O_RDWR, 0);
+	if(fd < 0)
+	{
+		DEBUG_PW("shm_open %s failed %s\n", shm_name, strerror(errno));
+		return NULL;
+	}
+	BoundedBuffer* head = (BoundedBuffer*)mmap(NULL, sizeof(BoundedBuffer), PROT_READ, MAP_SHARED, fd, 0);
+	if(MAP_FAILED == head)
+	{
+		DEBUG_PW("mmap %s failed %s\n", shm_name, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	if(SHM_MAGIC != LOAD_ACQUIRE(&head->magic))
+	{
+		DEBUG_PW("%s is not initialized\n", shm_name);
+		munmap(head, sizeof(BoundedBuffer));
+		close(fd);
+		return NULL;
+	}
+	void* base = head->base;
+	size_t length = head->length;
+	munmap(head, sizeof(BoundedBuffer));
+	void* addr = mmap(base, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+	close(fd);
+	if(MAP_FAILED == addr)
+	{
+		DEBUG_PW("mmap %s at %p failed %s\n", shm_name, base, strerror(errno));
+		return NULL;
+	}
+	if(addr != base)
+	{
+		//老内核不认识MAP_FIXED_NOREPLACE时只把地址当作提示
+		DEBUG_PW("mmap %s at %p got %p\n", shm_name, base, addr);
+		munmap(addr, length);
+		return NULL;
+	}
+	return (BoundedBuffer*)addr;
+}
+
+//释放缓冲区，共享内存由创建者删除名字，已注册的其它进程解除映射后内存才真正释放，持久化文件先同步到磁盘
+void buffer_destroy(BoundedBuffer* b)
+{
+	if(b->bPersist)
+	{
+		msync(b->base, b->length, MS_SYNC);
+		munmap(b->base, b->length);
+		return;
+	}
+	if(b->bShared)
+	{
+		if(!g_shm_attach)
+		{
+			shm_unlink(g_shm_name);
+		}
+		munmap(b->base, b->length);
+		return;
+	}
+	pthread_mutex_destroy(&b->lock);
+	pthread_mutex_destroy(&b->producer_lock);
+	pthread_cond_destroy(&b->full);
+	pthread_cond_destroy(&b->empty);
+	free(b);
+}
+//最小的可写长度，由最慢的那个消费者决定
 int avilable_write_len()
 {
-	int min_avilable_write_len = BUFFER_SIZE;
-	for (int i = 0; i < CONSUMER_NUM; i++)
-	{
-		int len = 0;
-		if(g_buffer.read_idx[i] > g_buffer.write_idx)
-		{
-			len = g_buffer.read_idx[i] - g_buffer.write_idx;
-		}
-		else
-		{
-			len = g_buffer.size - g_buffer.write_idx  + g_buffer.read_idx[i];
-		}
-		//取最小的可写入长度，它代表了最慢的那个消费者
-		if(len < min_avilable_write_len)
-		{
-			min_avilable_write_len = len;
-		}
-	}
-	return min_avilable_write_len;
+	int64_t min_seq = gating_min();
+	if(min_seq >= g_buffer->cursor)
+	{
+		return g_buffer->size;
+	}
+	return g_buffer->size - (int)(g_buffer->cursor - min_seq);
+}
+
+/*
+可连续写入的个数，需要处理第一次启动时，读写指针相等的情况
+1、写指针对应的使用计数等于0，代表正在被占用，加快判断
+2、写指针不能超过所有的读指针
+3、不跨过缓冲区末尾，保证返回的槽位在内存中连续
+*/
+int avilable_write_count(int max_count)
+{
+	int count = avilable_write_len() - 1;//这里判断可写入的长度大于1，是为了让读写指针在启动之后，永不相遇
+	if(count > max_count)
+	{
+		count = max_count;
+	}
+	if(count > g_buffer->size - g_buffer->write_idx)
+	{
+		count = g_buffer->size - g_buffer->write_idx;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		if(g_buffer->buf_used_count[g_buffer->write_idx + i] > 0)
+		{
+			return i;
+		}
+	}
+	return count < 0 ? 0 : count;
+}
+
+int64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * (int64_t)1000000000 + ts.tv_nsec;
+}
+
+/*
+每个线程的等待统计，-T时每个生产者和消费者线程一份，只有这个线程写入，relaxed原子操作，其它线程随时可以读取快照
+一次等待从发现缓冲区满(生产者)或空(消费者)开始，到可以继续为止，期间自旋、让出CPU和阻塞的时间都算在blocked_ns中
+醒来后条件仍不满足、需要再次阻塞的算一次虚假唤醒
+不统计时t_wait_stats为NULL，快速路径上只多一次判断
+*/
+typedef struct {
+    int64_t waits;            // 进入等待的次数
+    int64_t wakeups;          // 从条件变量或futex上醒来的次数
+    int64_t spurious;         // 醒来后仍要继续等待的次数
+    int64_t blocked_ns;       // 等待的总时间
+    int64_t blocked_max_ns;   // 最长的一次等待
+    int64_t notifies;         // 发出的唤醒，互斥模式为signal/broadcast，无锁模式为futex唤醒的系统调用
+    int64_t lock_num;         // g_buffer->lock的加锁次数
+    int64_t lock_contended;   // 加锁时锁已被其它线程持有的次数
+    int64_t lock_wait_ns;     // 等待加锁的总时间
+    int64_t lock_hold_ns;     // 持有锁的总时间，不包括在条件变量上等待的时间
+    int64_t lock_hold_max_ns; // 最长的一次持有
+} CACHE_ALIGNED WaitStats;
+
+static WaitStats* g_producer_stats = NULL;//每个生产者线程的等待统计，-T时分配
+static WaitStats* g_consumer_stats = NULL;//每个消费者线程的等待统计，-T时分配
+static __thread WaitStats* t_wait_stats = NULL;//本线程的等待统计，不统计的线程为NULL
+static __thread int64_t t_lock_start = 0;//本线程这次持有g_buffer->lock的开始时间
+
+#define STAT_ADD(field, v)      STORE_RELAXED(&t_wait_stats->field, LOAD_RELAXED(&t_wait_stats->field) + (v))
+#define STAT_MAX(field, v)      do{if ((v) > LOAD_RELAXED(&t_wait_stats->field)) STORE_RELAXED(&t_wait_stats->field, (v));}while(0)
+
+//开始一次等待，返回开始时间，不统计时返回0
+static int64_t wait_begin()
+{
+    if (NULL == t_wait_stats) {
+        return 0;
+    }
+    STAT_ADD(waits, 1);
+    return monotonic_ns();
+}
+
+//结束一次等待，start为0代表没有等待或者不统计
+static void wait_end(int64_t start)
+{
+    if (NULL == t_wait_stats || 0 == start) {
+        return;
+    }
+    int64_t ns = monotonic_ns() - start;
+    STAT_ADD(blocked_ns, ns);
+    STAT_MAX(blocked_max_ns, ns);
+}
+
+//从阻塞中醒来，bSpurious为true代表醒来后条件仍不满足
+static void wait_wakeup(bool bSpurious)
+{
+    if (t_wait_stats) {
+        STAT_ADD(wakeups, 1);
+        STAT_ADD(spurious, bSpurious ? 1 : 0);
+    }
+}
+
+static void wait_notify()
+{
+    if (t_wait_stats) {
+        STAT_ADD(notifies, 1);
+    }
+}
+
+//读取一个线程的等待统计快照，字段之间不是同一时刻的值，但每个字段都是完整的
+void wait_stats_snapshot(const WaitStats* s,WaitStats* out)
+{
+    out->waits = LOAD_RELAXED(&s->waits);
+    out->wakeups = LOAD_RELAXED(&s->wakeups);
+    out->spurious = LOAD_RELAXED(&s->spurious);
+    out->blocked_ns = LOAD_RELAXED(&s->blocked_ns);
+    out->blocked_max_ns = LOAD_RELAXED(&s->blocked_max_ns);
+    out->notifies = LOAD_RELAXED(&s->notifies);
+    out->lock_num = LOAD_RELAXED(&s->lock_num);
+    out->lock_contended = LOAD_RELAXED(&s->lock_contended);
+    out->lock_wait_ns = LOAD_RELAXED(&s->lock_wait_ns);
+    out->lock_hold_ns = LOAD_RELAXED(&s->lock_hold_ns);
+    out->lock_hold_max_ns = LOAD_RELAXED(&s->lock_hold_max_ns);
+}
+
+//共享内存中的停车字要被其它进程唤醒，不能用PRIVATE
+static long futex_wait(int* addr,int val,const struct timespec* timeout)
+{
+    return syscall(SYS_futex, addr, g_buffer->bShared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+static long futex_wake(int* addr,int num)
+{
+    return syscall(SYS_futex, addr, g_buffer->bShared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+//唤醒停车字上的线程，只有确实停车的线程才会产生系统调用
+static void park_wake(int* park)
+{
+    if (LOAD_SEQ_CST(park) && __atomic_exchange_n(park, 0, __ATOMIC_SEQ_CST)) {
+        futex_wake(park, 1);
+        wait_notify();
+    }
+}
+
+/*
+无锁广播模式
+生产者只写g_buffer->cursor，每个消费者只写自己的g_buffer->read_seq，不再需要g_buffer->lock
+序列号seq对应的槽位可写的条件是：最慢的消费者都已经读完了上一轮的seq - size
+序列号seq可读的条件是：seq < g_buffer->cursor
+*/
+
+static const char* g_wait_names[] = {"spin", "yield", "park", "adaptive"};
+
+/*
+按照等待策略执行一次空等，tries为本次等待已经空等的次数
+返回1代表调用方需要停车，停车前调用方会再检查一次等待条件
+*/
+int wait_idle(int strategy,int* tries)
+{
+    int n = (*tries)++;
+    if (WAIT_SPIN == strategy || n < WAIT_SPIN_TRIES) {
+        CPU_RELAX();
+        return 0;
+    }
+    if (WAIT_YIELD == strategy || (WAIT_ADAPTIVE == strategy && n < WAIT_SPIN_TRIES + WAIT_YIELD_TRIES)) {
+        sched_yield();
+        return 0;
+    }
+    return 1;
+}
+
+//解析等待策略名称，失败返回-1
+int parse_wait_strategy(const char* name)
+{
+    for (int i = 0; i < (int)(sizeof(g_wait_names) / sizeof(g_wait_names[0])); i++) {
+        if (0 == strcmp(name, g_wait_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const char* g_overrun_names[] = {"block", "lossy"};
+
+//套圈策略名转为OVERRUN_*，不认识的返回-1
+int parse_overrun_policy(const char* name)
+{
+    for (int i = 0; i < (int)(sizeof(g_overrun_names) / sizeof(g_overrun_names[0])); i++) {
+        if (0 == strcmp(name, g_overrun_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//休眠微秒数，负数返回-1
+int parse_delay(const char* value)
+{
+    int delay = atoi(value);
+    return delay < 0 ? -1 : delay;
+}
+
+//解析"值"或"消费者编号:值"形式的消费者参数，不带编号时设置所有消费者，参数错误返回-1
+int parse_consumer_option(const char* arg,int (*parse)(const char*),int* values)
+{
+    int id = -1;
+    const char* value = strchr(arg, ':');
+    if (NULL == value) {
+        value = arg;
+    } else {
+        id = atoi(arg);
+        if (id < 0 || id >= g_consumer_num) {
+            return -1;
+        }
+        value++;
+    }
+    int v = parse(value);
+    if (v < 0) {
+        return -1;
+    }
+    for (int i = 0; i < g_consumer_num; i++) {
+        if (id < 0 || id == i) {
+            values[i] = v;
+        }
+    }
+    return v;
+}
+
+//解析"消费者编号:上游编号,上游编号..."，编号都是消费者线程编号，参数错误返回-1
+int parse_consumer_deps(const char* arg)
+{
+    const char* value = strchr(arg, ':');
+    int id = atoi(arg);
+    if (NULL == value || id < 0 || id >= g_consumer_num) {
+        return -1;
+    }
+    int dep_num = 0;
+    while (NULL != value) {
+        int up = atoi(value + 1);
+        if (dep_num >= CONSUMER_DEP_MAX || up < 0 || up >= g_consumer_num || up == id) {
+            return -1;
+        }
+        g_consumer_deps[id * CONSUMER_DEP_MAX + dep_num++] = up;
+        value = strchr(value + 1, ',');
+    }
+    g_consumer_dep_num[id] = dep_num;
+    return dep_num;
+}
+
+//检查依赖关系，不能有环，有损消费者不能参与依赖，上游不能中途注销，不合法返回-1
+int check_consumer_deps()
+{
+    bool bHasDeps = false;
+    bool* bReady = (bool*)malloc(sizeof(bool) * (g_consumer_num + 1));
+    for (int i = 0; i < g_consumer_num; i++) {
+        bReady[i] = (0 == g_consumer_dep_num[i]);
+        bHasDeps = bHasDeps || !bReady[i];
+        for (int j = 0; j < g_consumer_dep_num[i]; j++) {
+            if (OVERRUN_LOSSY == g_consumer_policy[i] || OVERRUN_LOSSY == g_consumer_policy[g_consumer_deps[i * CONSUMER_DEP_MAX + j]]) {
+                printf("consumer[%d] lossy consumers can not be in a dependency graph\n", i);
+                free(bReady);
+                return -1;
+            }
+        }
+    }
+    //每一轮把上游都已就绪的消费者标记为就绪，没有新的就绪消费者时剩下的就在环上
+    bool bChanged = true;
+    while (bChanged) {
+        bChanged = false;
+        for (int i = 0; i < g_consumer_num; i++) {
+            bool bAllReady = !bReady[i];
+            for (int j = 0; j < g_consumer_dep_num[i] && bAllReady; j++) {
+                bAllReady = bReady[g_consumer_deps[i * CONSUMER_DEP_MAX + j]];
+            }
+            if (bAllReady) {
+                bReady[i] = true;
+                bChanged = true;
+            }
+        }
+    }
+    int ret = 0;
+    for (int i = 0; i < g_consumer_num; i++) {
+        if (!bReady[i]) {
+            printf("consumer[%d] is on a dependency cycle\n", i);
+            ret = -1;
+        }
+    }
+    if (bHasDeps && g_consumer_lifetime > 0) {
+        printf("-l can not be used with -g\n");
+        ret = -1;
+    }
+    free(bReady);
+    return ret;
+}
+
+/*
+变长模式只支持阻塞消费者，有损消费者读取的副本按定长记录复制，无法校验变长记录是否被覆盖
+一条记录加上可能的填充不能超过缓冲区，否则生产者永远申请不到
+*/
+int check_var_mode()
+{
+    if (0 == g_var_max) {
+        return 0;
+    }
+    for (int i = 0; i < g_consumer_num; i++) {
+        if (OVERRUN_LOSSY == g_consumer_policy[i]) {
+            printf("variable records do not support lossy consumer %d\n", i);
+            return -1;
+        }
+    }
+    if (2 * var_units(g_var_max) > g_buffer_size) {
+        printf("buffer of %d slots is too small for %d byte records, need at least %d\n",
+            g_buffer_size, g_var_max, 2 * var_units(g_var_max));
+        return -1;
+    }
+    return 0;
+}
+
+//生产者可以写到的下界，小于返回值+size的序列号都可写，没有消费者时由cursor限制，不会覆盖未发布的批次
+int64_t lf_write_limit()
+{
+    int64_t min_seq = gating_min();
+    int64_t cursor = LOAD_SEQ_CST(&g_buffer->cursor);
+    return min_seq < cursor ? min_seq : cursor;
+}
+
+/*
+生产者停车，直到seq对应的槽位可写入或程序退出
+先声明停车再重新检查条件，消费者前移后先更新树再检查producer_park，两边至少有一方能看到对方的写入
+多生产者时推进cursor的生产者也会唤醒停车的生产者
+*/
+bool lf_park_producer(int producerId,int64_t seq)
+{
+    //共享内存时消费者进程可能崩溃，不会再唤醒生产者，定时醒来检查，超时返回true
+    struct timespec timeout = {0, 100 * 1000 * 1000};
+    bool bTimeout = false;
+    int* park = &g_buffer->producer_park[producerId].value;
+    STORE_SEQ_CST(park, 1);
+    if (seq - g_buffer->size >= lf_write_limit() && LOAD_SEQ_CST(&g_buffer->run_flag)) {
+        bTimeout = futex_wait(park, 1, g_buffer->bShared ? &timeout : NULL) < 0 && ETIMEDOUT == errno;
+        if (t_wait_stats && !bTimeout) {
+            wait_wakeup(seq - g_buffer->size >= lf_write_limit() && LOAD_SEQ_CST(&g_buffer->run_flag));
+        }
+    }
+    STORE_RELEASE(park, 0);
+    return bTimeout;
+}
+
+//唤醒已停车的生产者，共享内存时生产者可能在其它进程中，个数以缓冲区中的为准
+void lf_wake_producers()
+{
+    for (int i = 0; i < g_buffer->producer_num; i++) {
+        park_wake(&g_buffer->producer_park[i].value);
+    }
+}
+
+/*
+消费者可以读取到的位置，小于返回值的序列号都可读
+没有依赖时就是cursor，有依赖时还要等所有上游都释放，上游可以就地修改槽位再交给下游，不需要复制
+上游释放时用seq_cst写read_seq，这里读到新位置后也能看到上游对槽位的修改
+上游注销后read_seq为INT64_MAX，下游只受cursor限制
+*/
+int64_t read_barrier(ConsumerCursor* c)
+{
+    int64_t barrier = LOAD_SEQ_CST(&g_buffer->cursor);
+    for (int i = 0; i < c->dep_num; i++) {
+        int64_t seq = LOAD_SEQ_CST(&g_buffer->consumers[c->deps[i]].read_seq);
+        if (seq < barrier) {
+            barrier = seq;
+        }
+    }
+    return barrier;
+}
+
+//消费者停车，直到seq可读或程序退出，退出后上游还没有读完时继续等待上游
+void lf_park_consumer(int consumerId,int64_t seq)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    int* park = &c->park;
+    STORE_SEQ_CST(park, 1);
+    __atomic_add_fetch(&g_buffer->parked_num, 1, __ATOMIC_SEQ_CST);
+    int64_t barrier = read_barrier(c);
+    if (barrier <= seq && (LOAD_SEQ_CST(&g_buffer->run_flag) || barrier < LOAD_SEQ_CST(&g_buffer->cursor))) {
+        futex_wait(park, 1, NULL);
+        if (t_wait_stats) {
+            wait_wakeup(read_barrier(c) <= seq && LOAD_SEQ_CST(&g_buffer->run_flag));
+        }
+    }
+    __atomic_sub_fetch(&g_buffer->parked_num, 1, __ATOMIC_SEQ_CST);
+    STORE_RELEASE(park, 0);
+}
+
+//发布或退出后唤醒已停车的消费者，没有消费者停车时只需要读取一次parked_num
+void lf_wake_consumers()
+{
+    if (0 == LOAD_SEQ_CST(&g_buffer->parked_num)) {
+        return;
+    }
+    for (int i = 0; i < g_buffer->consumer_max; i++) {
+        park_wake(&g_buffer->consumers[i].park);
+    }
+}
+
+/*
+持有g_buffer->lock，共享内存时持锁的进程可能崩溃，锁是robust的，接手后标记为一致
+统计时先trylock，失败才算一次竞争，并记录等锁和持锁的时间
+*/
+void buffer_lock()
+{
+    int ret = 0;
+    if (t_wait_stats) {
+        STAT_ADD(lock_num, 1);
+        if (EBUSY == (ret = pthread_mutex_trylock(&g_buffer->lock))) {
+            int64_t start = monotonic_ns();
+            ret = pthread_mutex_lock(&g_buffer->lock);
+            STAT_ADD(lock_contended, 1);
+            STAT_ADD(lock_wait_ns, monotonic_ns() - start);
+        }
+        t_lock_start = monotonic_ns();
+    } else {
+        ret = pthread_mutex_lock(&g_buffer->lock);
+    }
+    if (EOWNERDEAD == ret) {
+        pthread_mutex_consistent(&g_buffer->lock);
+    }
+}
+
+//结束一次持锁的计时
+static void buffer_hold_end()
+{
+    if (t_wait_stats) {
+        int64_t ns = monotonic_ns() - t_lock_start;
+        STAT_ADD(lock_hold_ns, ns);
+        STAT_MAX(lock_hold_max_ns, ns);
+    }
+}
+
+void buffer_unlock()
+{
+    buffer_hold_end();
+    pthread_mutex_unlock(&g_buffer->lock);
+}
+
+//在条件变量上等待，等待期间锁已释放，不算持锁时间
+void buffer_cond_wait(pthread_cond_t* cond)
+{
+    buffer_hold_end();
+    pthread_cond_wait(cond, &g_buffer->lock);
+    if (t_wait_stats) {
+        STAT_ADD(wakeups, 1);
+        t_lock_start = monotonic_ns();
+    }
+}
+
+//注册这个消费者的进程是否已经退出，只有共享内存时才会发生
+bool consumer_owner_dead(ConsumerCursor* c)
+{
+    return g_buffer->bShared && CONSUMER_ACTIVE == c->state && c->owner != getpid()
+        && kill(c->owner, 0) < 0 && ESRCH == errno;
+}
+
+//持有锁时释放消费者表中的位置，叶子变为INT64_MAX后不再限制生产者和下游
+void consumer_free_slot(int consumerId)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    if (g_buffer->bPersist && !LOAD_ACQUIRE(&g_buffer->run_flag)) {
+        //程序退出时记下读取进度，下次打开文件后从这里继续，运行中注销再注册的消费者不恢复进度
+        c->resume_seq = c->read_seq;
+    }
+    STORE_SEQ_CST(&c->read_seq, INT64_MAX);
+    gating_update(consumerId);
+    c->state = CONSUMER_FREE;
+    c->copy = NULL;
+    for (int i = 0; i < c->dep_num; i++) {
+        ConsumerCursor* up = &g_buffer->consumers[c->deps[i]];
+        STORE_SEQ_CST(&up->dependent_num, up->dependent_num - 1);
+    }
+    c->dep_num = 0;
+}
+
+/*
+回收已经退出的进程留下的消费者，由等待中的生产者定时调用
+进程可能死在更新gating树的过程中，先把gating_busy恢复为偶数，再从叶子到根完整地重算一遍
+*/
+void consumer_reap_dead()
+{
+    int reaped = 0;
+    buffer_lock();
+    for (int i = 0; i < g_buffer->consumer_max; i++) {
+        ConsumerCursor* c = &g_buffer->consumers[i];
+        if (!consumer_owner_dead(c)) {
+            continue;
+        }
+        DEBUG_PW("reap consumer[%d] of dead process[%d]\n", i, (int)c->owner);
+        if (c->gating_busy & 1) {
+            STORE_SEQ_CST(&c->gating_busy, c->gating_busy + 1);
+        }
+        consumer_free_slot(i);
+        gating_propagate(i, true);
+        reaped++;
+    }
+    buffer_unlock();
+    if (reaped > 0) {
+        lf_wake_consumers();
+    }
+}
+
+/*
+生产者空等一次，seq为要写入的最后一个序列号，需要停车时在停车字上等待
+共享内存时定时回收已经退出的进程留下的消费者
+*/
+static void lf_producer_idle(int producerId,int64_t seq,int* tries)
+{
+    if (wait_idle(g_producer_wait, tries)) {
+        if (lf_park_producer(producerId, seq)) {
+            consumer_reap_dead();
+        }
+    } else if (g_buffer->bShared && 0 == (*tries & 0xffff)) {
+        consumer_reap_dead();
+    }
+}
+
+/*
+等待直到下一个序列号对应的槽位可写入，缓存的可写下界足够时不需要读取树
+单生产者直接前移next_seq，多生产者用CAS申请，申请失败说明被其它生产者抢先，重新计算
+返回申请到的个数，*seq为第一个序列号，达到记录总数时返回0，程序退出时返回-1
+*/
+int lf_get_write_batch(int producerId,int max_count,MyData** data,int* write_idx,int64_t* seq)
+{
+    int tries = 0;
+    int64_t wait_start = 0;
+    for (;;) {
+        int64_t next = LOAD_RELAXED(&g_buffer->next_seq);
+        if (g_max_records > 0 && g_max_records - (next - g_start_seq) < max_count) {
+            max_count = (int)(g_max_records - (next - g_start_seq));
+            if (max_count <= 0) {
+                wait_end(wait_start);
+                return 0;
+            }
+        }
+        int64_t cached = LOAD_RELAXED(&g_buffer->cached_gating);
+        if (next - g_buffer->size >= cached) {
+            //没有注册的消费者时根为INT64_MAX，只缓存到cursor，之后注册的消费者从不小于这里的cursor开始读取
+            cached = lf_write_limit();
+            STORE_RELAXED(&g_buffer->cached_gating, cached);
+            if (next - g_buffer->size >= cached) {
+                if (!LOAD_ACQUIRE(&g_buffer->run_flag)) {
+                    wait_end(wait_start);
+                    return -1;
+                }
+                if (0 == wait_start) {
+                    wait_start = wait_begin();
+                }
+                lf_producer_idle(producerId, next, &tries);
+                continue;
+            }
+        }
+        int idx = (int)(next % g_buffer->size);
+        int64_t count = cached + g_buffer->size - next;
+        if (count > max_count) {
+            count = max_count;
+        }
+        if (count > g_buffer->size - idx) {
+            count = g_buffer->size - idx;
+        }
+        //先公开要覆盖的范围再写数据，有损消费者读完后据此判断读到的槽位是否被覆盖
+        if (1 == g_producer_num) {
+            STORE_RELAXED(&g_buffer->next_seq, next + count);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+        } else if (!__atomic_compare_exchange_n(&g_buffer->next_seq, &next, next + count, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        *seq = next;
+        *write_idx = idx;
+        *data = &g_buffer->buffer[idx];
+        wait_end(wait_start);
+        return (int)count;
+    }
+}
+
+/*
+发布从seq开始的count个序列号，保证消费者看到cursor时也能看到这些槽位中的数据，再唤醒已停车的消费者
+多生产者时先标记本批次已发布，再从cursor开始推进所有连续发布的批次
+标记和推进都用seq_cst，前面的批次正在推进时，要么推进者看到本批次的标记，要么本生产者看到新的cursor
+*/
+void lf_write_batch_data(int64_t seq,int count)
+{
+    if (1 == g_producer_num) {
+        STORE_SEQ_CST(&g_buffer->cursor, seq + count);
+        lf_wake_consumers();
+        return;
+    }
+    STORE_SEQ_CST(&g_buffer->published[seq % g_buffer->size], seq + count);
+    int64_t cursor = LOAD_SEQ_CST(&g_buffer->cursor);
+    for (;;) {
+        //上一圈留下的标记不会超过cursor，cursor总是停在某个批次的开头
+        int64_t end = LOAD_SEQ_CST(&g_buffer->published[cursor % g_buffer->size]);
+        if (end <= cursor) {
+            break;
+        }
+        //失败时cursor被更新为其它生产者推进后的值，继续从那里推进
+        if (__atomic_compare_exchange_n(&g_buffer->cursor, &cursor, end, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            cursor = end;
+        }
+    }
+    lf_wake_consumers();
+    lf_wake_producers();
+}
+
+//等待直到seq可读，返回可读取到的位置，生产者停止后已经读完时返回-1
+static int64_t lf_wait_readable(int consumerId,int64_t seq)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    int64_t cursor = 0;
+    int tries = 0;
+    int64_t wait_start = 0;
+    while ((cursor = read_barrier(c)) <= seq) {
+        if (!LOAD_ACQUIRE(&g_buffer->run_flag) && LOAD_ACQUIRE(&g_buffer->cursor) <= seq) {
+            wait_end(wait_start);
+            return -1;
+        }
+        if (0 == wait_start) {
+            wait_start = wait_begin();
+        }
+        if (wait_idle(c->wait_strategy, &tries)) {
+            lf_park_consumer(consumerId, seq);
+        }
+    }
+    wait_end(wait_start);
+    return cursor;
+}
+
+//等待直到消费者的下一个序列号已被发布，返回从该序列号到已发布位置之间的连续槽位个数
+//读取后只前移fetch_seq，槽位在释放前一直有效，生产者停止后读完剩余数据再返回-1
+int lf_read_batch_data(int consumerId,int max_count,MyData** data)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    for (;;) {
+        int64_t seq = c->fetch_seq;
+        int64_t cursor = lf_wait_readable(consumerId, seq);
+        if (cursor < 0) {
+            return -1;
+        }
+        int read_idx = (int)(seq % g_buffer->size);
+        int64_t count = cursor - seq;
+        if (count > max_count) {
+            count = max_count;
+        }
+        if (count > g_buffer->size - read_idx) {
+            count = g_buffer->size - read_idx;
+        }
+        if (OVERRUN_BLOCK == c->policy) {
+            *data = &(g_buffer->buffer[read_idx]);
+            c->fetch_seq += count;
+            return (int)count;
+        }
+        //有损消费者不限制生产者，先复制出来，再确认生产者还没有开始覆盖seq所在的槽位
+        if (cursor - seq <= g_buffer->size) {
+            memcpy(c->copy, &g_buffer->buffer[read_idx], sizeof(MyData) * count);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (LOAD_RELAXED(&g_buffer->next_seq) <= seq + g_buffer->size) {
+                *data = c->copy;
+                c->fetch_seq += count;
+                return (int)count;
+            }
+        }
+        //被套圈，跳到最新可读的记录重新读取
+        cursor = read_barrier(c);
+        c->lapped_num++;
+        c->lost_num += cursor - 1 - seq;
+        c->fetch_seq = cursor - 1;
+        STORE_RELEASE(&c->read_seq, cursor - 1);
+    }
+}
+
+//无锁模式下是否有可以立即读取的数据，异步输出的消费者在没有新数据时先等待写完成，不阻塞在读取上
+bool lf_read_ready(int consumerId)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    return read_barrier(c) > c->fetch_seq || !LOAD_ACQUIRE(&g_buffer->run_flag);
+}
+
+static VarRecord* var_record(int64_t seq)
+{
+    return (VarRecord*)((char*)g_buffer->buffer + (seq % g_buffer->size) * VAR_UNIT);
+}
+
+/*
+变长模式申请一条length字节的记录，只在无锁模式下使用，发布和释放与定长模式相同，序列号按槽位计算
+记录必须在内存中连续，环末尾剩下的槽位放不下时，和记录一起申请一条填满到末尾的填充记录，记录从环的开头写起
+填充加记录一起申请、一起发布，消费者看到cursor时两者都已写好
+*payload为数据的写入位置，*seq为申请到的第一个序列号，返回申请到的槽位个数(包括填充)，用它调用write_batch_data
+程序退出时返回-1
+*/
+int var_get_write_batch(int producerId,int length,char** payload,int64_t* seq)
+{
+    int units = var_units(length);
+    int tries = 0;
+    int64_t wait_start = 0;
+    for (;;) {
+        int64_t next = LOAD_RELAXED(&g_buffer->next_seq);
+        int idx = (int)(next % g_buffer->size);
+        int pad = units > g_buffer->size - idx ? g_buffer->size - idx : 0;
+        int total = pad + units;
+        int64_t cached = LOAD_RELAXED(&g_buffer->cached_gating);
+        if (next + total - g_buffer->size > cached) {
+            cached = lf_write_limit();
+            STORE_RELAXED(&g_buffer->cached_gating, cached);
+            if (next + total - g_buffer->size > cached) {
+                if (!LOAD_ACQUIRE(&g_buffer->run_flag)) {
+                    wait_end(wait_start);
+                    return -1;
+                }
+                if (0 == wait_start) {
+                    wait_start = wait_begin();
+                }
+                lf_producer_idle(producerId, next + total - 1, &tries);
+                continue;
+            }
+        }
+        if (1 == g_producer_num) {
+            STORE_RELAXED(&g_buffer->next_seq, next + total);
+        } else if (!__atomic_compare_exchange_n(&g_buffer->next_seq, &next, next + total, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (pad) {
+            VarRecord* r = var_record(next);
+            r->type = VAR_PAD;
+            r->length = pad * VAR_UNIT - sizeof(VarRecord);
+        }
+        VarRecord* r = var_record(next + pad);
+        r->type = VAR_DATA;
+        r->length = length;
+        r->publish_ns = 0;
+        *payload = (char*)(r + 1);
+        *seq = next;
+        wait_end(wait_start);
+        return total;
+    }
+}
+
+//变长模式下设置已申请记录的发布时间，在write_batch_data之前调用
+void var_set_publish_ns(char* payload,int64_t ns)
+{
+    ((VarRecord*)payload - 1)->publish_ns = ns;
+}
+
+/*
+变长模式读取最多max_num条已发布的记录，views直接指向环中的数据，不复制
+填充记录直接跳过，*units为读到的记录和跳过的填充一共占用的槽位，处理完后用它调用release_batch_data
+只读到填充时返回0，*units大于0，同样需要释放；生产者停止后读完剩余数据再返回-1
+*/
+int var_read_batch(int consumerId,VarView* views,int max_num,int* units)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    int64_t seq = c->fetch_seq;
+    int64_t cursor = lf_wait_readable(consumerId, seq);
+    if (cursor < 0) {
+        return -1;
+    }
+    int num = 0;
+    while (seq < cursor && num < max_num) {
+        VarRecord* r = var_record(seq);
+        if (VAR_DATA == r->type) {
+            views[num].data = (const char*)(r + 1);
+            views[num].length = r->length;
+            views[num].seq = seq;
+            views[num].publish_ns = r->publish_ns;
+            num++;
+        }
+        seq += var_units(r->length);
+    }
+    *units = (int)(seq - c->fetch_seq);
+    c->fetch_seq = seq;
+    return num;
+}
+
+//将消费者的序列号前移count个并更新最慢消费者，保证生产者看到新序列号时，本消费者已经读完这些槽位
+void lf_release_batch_data(int consumerId,int count)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    if (OVERRUN_LOSSY == c->policy) {
+        //有损消费者不参与gating，生产者也不会等待它
+        STORE_RELEASE(&c->read_seq, c->read_seq + count);
+        return;
+    }
+    STORE_SEQ_CST(&c->gating_busy, c->gating_busy + 1);
+    STORE_SEQ_CST(&c->read_seq, c->read_seq + count);
+    gating_propagate(consumerId, false);
+    STORE_RELEASE(&c->gating_busy, c->gating_busy + 1);
+    lf_wake_producers();
+    if (LOAD_SEQ_CST(&c->dependent_num) > 0) {
+        lf_wake_consumers();
+    }
+}
+
+/*
+注册时开始读取的位置，一般是当前最新可读的位置
+持久化文件恢复后的第一次注册从上次释放的位置继续，恢复时已把它推到被覆盖的范围之后，
+此时生产者还没有启动，不会有生产者按更大的旧根覆盖这些槽位
+*/
+int64_t attach_seq(ConsumerCursor* c)
+{
+    int64_t seq = read_barrier(c);
+    if (c->resume_seq >= 0 && c->resume_seq < seq) {
+        seq = c->resume_seq;
+    }
+    return seq;
+}
+
+/*
+无锁模式下注册消费者，注册和注销之间用g_buffer->lock串行化，不影响生产者和其它消费者
+叶子从INT64_MAX变小，其它正在更新树的消费者可能读到旧的叶子，算出偏大的值，所以：
+1、先把叶子设为当前可读的位置，再等待所有在此之前开始的树更新完成，之后开始的更新都能看到新叶子
+2、从叶子到根完整地重算一遍，覆盖掉可能写入的偏大值
+3、生产者在此之前读到的根都不会超过当时的cursor和上游位置，所以从此时最新的可读位置开始读取是安全的
+*/
+int lf_consumer_attach(int consumerId)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    if (OVERRUN_LOSSY == c->policy) {
+        //gating_node_value看到有损策略就忽略这个叶子，不需要等待其它消费者
+        c->copy = (MyData*)malloc(sizeof(MyData) * g_buffer->size);
+        STORE_SEQ_CST(&c->read_seq, attach_seq(c));
+        c->fetch_seq = c->read_seq;
+        c->resume_seq = -1;
+        return consumerId;
+    }
+    STORE_SEQ_CST(&c->read_seq, attach_seq(c));
+    for (int i = 0; i < g_buffer->consumer_max; i++) {
+        int busy = LOAD_SEQ_CST(&g_buffer->consumers[i].gating_busy);
+        while ((busy & 1) && LOAD_SEQ_CST(&g_buffer->consumers[i].gating_busy) == busy
+            && !consumer_owner_dead(&g_buffer->consumers[i])) {
+            sched_yield();
+        }
+    }
+    gating_propagate(consumerId, true);
+    STORE_SEQ_CST(&c->read_seq, attach_seq(c));
+    c->fetch_seq = c->read_seq;
+    c->resume_seq = -1;
+    gating_update(consumerId);
+    return consumerId;
+}
+
+/*
+注册一个消费者，返回消费者编号，从注册时最新可读的数据开始读取
+deps为上游消费者编号，只能读取所有上游都已释放的槽位，可以组成流水线和菱形依赖
+上游和下游都必须是阻塞消费者，上游必须已注册，并且在下游注销之前保持注册
+slot为-1时使用第一个空闲位置，否则只能注册到这个位置，持久化时每个消费者线程固定使用自己的位置，重启后才能找回进度
+消费者表已满、位置被占用、上游不合法或程序已退出时返回-1
+*/
+int consumer_attach(int wait_strategy,int policy,const int* deps,int dep_num,int slot)
+{
+    int consumerId = -1;
+    buffer_lock();
+    for (int i = 0; i < dep_num; i++) {
+        ConsumerCursor* up = &g_buffer->consumers[deps[i]];
+        if (CONSUMER_ACTIVE != up->state || OVERRUN_LOSSY == up->policy || OVERRUN_LOSSY == policy) {
+            buffer_unlock();
+            return -1;
+        }
+    }
+    for (int i = 0; i < g_buffer->consumer_max && g_buffer->run_flag; i++) {
+        if (CONSUMER_FREE == g_buffer->consumers[i].state && (slot < 0 || slot == i)) {
+            consumerId = i;
+            break;
+        }
+    }
+    if (consumerId >= 0) {
+        ConsumerCursor* c = &g_buffer->consumers[consumerId];
+        c->state = CONSUMER_ACTIVE;
+        c->owner = getpid();
+        c->wait_strategy = wait_strategy;
+        STORE_SEQ_CST(&c->policy, policy);
+        c->park = 0;
+        c->lapped_num = 0;
+        c->lost_num = 0;
+        c->dep_num = dep_num;
+        for (int i = 0; i < dep_num; i++) {
+            c->deps[i] = deps[i];
+            ConsumerCursor* up = &g_buffer->consumers[deps[i]];
+            STORE_SEQ_CST(&up->dependent_num, up->dependent_num + 1);
+        }
+        if (MODE_LOCK_FREE == g_mode) {
+            lf_consumer_attach(consumerId);
+        } else {
+            //互斥模式下第一次读取时会跳到最新可读的位置，这里只需要保证生产者不会越过当前位置
+            c->read_idx = g_buffer->write_idx;
+            STORE_SEQ_CST(&c->read_seq, read_barrier(c));
+            gating_update(consumerId);
+        }
+    }
+    buffer_unlock();
+    return consumerId;
+}
+
+//注销消费者，叶子变为INT64_MAX后立即不再限制生产者和下游，再唤醒可能在等待这个消费者的生产者和下游
+void consumer_detach(int consumerId)
+{
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    buffer_lock();
+    free(c->copy);
+    consumer_free_slot(consumerId);
+    pthread_cond_signal(&g_buffer->full);
+    if (c->dependent_num > 0) {
+        pthread_cond_broadcast(&g_buffer->empty);
+    }
+    buffer_unlock();
+    lf_wake_producers();
+    if (MODE_LOCK_FREE == g_mode && c->dependent_num > 0) {
+        lf_wake_consumers();
+    }
 }
 
 /*
-可写的情况，需要处理第一次启动时，读写指针相等的情况
-1、写指针对应的使用计数等于0，代表正在被占用，加快判断
-2、写指针不能超过所有的读指针
+批量申请写入位置，阻塞等待直到至少有1个槽位可写入
+最多申请max_count个在内存中连续的槽位，data[0]到data[返回值-1]可以直接填充，*seq为data[0]的序列号
+返回实际申请到的个数，达到记录总数时返回0，程序退出时返回-1
+互斥模式的多生产者从申请一直到发布都持有producer_lock，返回值小于等于0时已经释放
 */
-bool avilable_write()
+int get_write_batch(int producerId,int max_count,MyData** data,int* write_idx,int64_t* seq)
 {
-	if((g_buffer.buf_used_count[g_buffer.write_idx] > 0)
-		|| (avilable_write_len() <= 1))//这里判断可写入的长度大于1，是为了让读写指针在启动之后，永不相遇
-	{
-		return false;
-	}
-	return true;
+    if (MODE_LOCK_FREE == g_mode) {
+        return lf_get_write_batch(producerId, max_count, data, write_idx, seq);
+    }
+    if (g_producer_num > 1) {
+        pthread_mutex_lock(&g_buffer->producer_lock);
+    }
+    buffer_lock();
+    if (g_max_records > 0 && g_max_records - (g_buffer->cursor - g_start_seq) < max_count) {
+        max_count = (int)(g_max_records - (g_buffer->cursor - g_start_seq));
+    }
+    // 等待缓冲区非满
+    int count = 0;
+    int64_t wait_start = 0;
+    while (max_count > 0 && (count = avilable_write_count(max_count)) <= 0) {
+        if (!g_buffer->run_flag) {
+            count = -1;
+            break;
+        }
+        if (wait_start) {
+            STAT_ADD(spurious, 1);
+        } else {
+            wait_start = wait_begin();
+        }
+        buffer_cond_wait(&g_buffer->full);
+    }
+    wait_end(wait_start);
+    *data = &g_buffer->buffer[g_buffer->write_idx];
+    *write_idx = g_buffer->write_idx;
+    *seq = g_buffer->cursor;
+    buffer_unlock();
+    if (count <= 0 && g_producer_num > 1) {
+        pthread_mutex_unlock(&g_buffer->producer_lock);
+    }
+    return count;
 }
 
-//阻塞等待，直到写指针位置可写入
-void get_write_pos(MyData** data,int* write_idx)
+//将写指针一次前移count个，所有消费者只唤醒一次
+void write_batch_data(int64_t seq,int count)
 {
-    pthread_mutex_lock(&g_buffer.lock);
-    // 等待缓冲区非满
-    while (!avilable_write()) {
-        pthread_cond_wait(&g_buffer.full, &g_buffer.lock);
+    if (MODE_LOCK_FREE == g_mode) {
+        lf_write_batch_data(seq, count);
+        return;
+    }
+    buffer_lock();
+    g_buffer->write_idx = (g_buffer->write_idx + count) % g_buffer->size;
+    g_buffer->cursor += count;
+    pthread_cond_broadcast(&g_buffer->empty);// 唤醒所有消费者
+    wait_notify();
+    buffer_unlock();
+    if (g_producer_num > 1) {
+        pthread_mutex_unlock(&g_buffer->producer_lock);
     }
-    *data = &g_buffer.buffer[g_buffer.write_idx];
-    *write_idx = g_buffer.write_idx;
-    pthread_mutex_unlock(&g_buffer.lock);
+}
+
+//阻塞等待，直到写指针位置可写入，程序退出或达到记录总数时返回-1
+int get_write_pos(int producerId,MyData** data,int* write_idx,int64_t* seq)
+{
+    return get_write_batch(producerId, 1, data, write_idx, seq) <= 0 ? -1 : 0;
 }
 
 //将写指针前移
-void write_one_data()
+void write_one_data(int64_t seq)
 {
-    pthread_mutex_lock(&g_buffer.lock);
-    g_buffer.write_idx = (g_buffer.write_idx + 1) % g_buffer.size;
-    pthread_cond_broadcast(&g_buffer.empty);// 唤醒所有消费者
-    pthread_mutex_unlock(&g_buffer.lock);
+    write_batch_data(seq, 1);
 }
 
 //获取可读取的长度
 int avilable_read_len(int read_idx)
 {
-	if(read_idx == g_buffer.write_idx)
+	if(read_idx == g_buffer->write_idx)
 	{
 		return 0;
 	}
-    else if(read_idx < g_buffer.write_idx)
+    else if(read_idx < g_buffer->write_idx)
     {
-        return g_buffer.write_idx - read_idx - 1;
+        return g_buffer->write_idx - read_idx - 1;
     }
-    return g_buffer.size + g_buffer.write_idx  - read_idx - 1;
+    return g_buffer->size + g_buffer->write_idx  - read_idx - 1;
+}
+
+//互斥模式下可读取的长度，有依赖时还要受上游位置限制
+int mutex_read_len(ConsumerCursor* c)
+{
+	int len = avilable_read_len(c->read_idx);
+	if(c->dep_num > 0)
+	{
+		int64_t lag = read_barrier(c) - c->read_seq;
+		int dep_len = lag <= 0 ? 0 : (int)(lag - 1);
+		if(dep_len < len)
+		{
+			len = dep_len;
+		}
+	}
+	return len;
+}
+
+/*
+互斥模式下有损消费者是否被套圈
+读写位置相同代表空，所以落后size-1条时就已经无法用下标区分，按套圈处理
+正在读取的槽位由buf_used_count保护，生产者不会覆盖
+*/
+bool mutex_lapped(ConsumerCursor* c)
+{
+	return OVERRUN_LOSSY == c->policy && g_buffer->cursor - c->read_seq >= g_buffer->size - 1;
 }
 
 /*
 读指针此时不更新，让写指针不要越过读指针，读取完成后，再将读指针前移
-也就是g_buffer.read_idx始终指向下一个即将要读的位置
+也就是g_buffer->read_idx始终指向下一个即将要读的位置
 判断是否可读的条件是,读指针与写指针不相同，且可读取的长度不为0，也就是写指针要超前读指针
+批量读取时返回从读指针开始，在内存中连续且可读的槽位个数，最多max_count个，
+data[0]到data[返回值-1]都可以直接读取，读完后调用release_batch_data一次释放
 */
-int read_data(int consumerId,bool bFirst,MyData** data)
+int read_batch_data(int consumerId,bool bFirst,int max_count,MyData** data)
 {
-    pthread_mutex_lock(&g_buffer.lock);
-    assert(0 <= g_buffer.read_idx[consumerId] && g_buffer.read_idx[consumerId] < g_buffer.size);
-    // 等待缓冲区非空
-    while (avilable_read_len(g_buffer.read_idx[consumerId]) <= 1) {
-        pthread_cond_wait(&g_buffer.empty, &g_buffer.lock);
+    if (MODE_LOCK_FREE == g_mode) {
+        return lf_read_batch_data(consumerId, max_count, data);
+    }
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    buffer_lock();
+    assert(0 <= c->read_idx && c->read_idx < g_buffer->size);
+    // 等待缓冲区非空，有损消费者被套圈时直接按第一次读取处理
+    bool bLapped = false;
+    int64_t wait_start = 0;
+    while (!(bLapped = mutex_lapped(c)) && mutex_read_len(c) <= 1) {
+        //退出时生产者已经没有新数据才返回，上游还在处理时继续等待上游
+        if (!g_buffer->run_flag && avilable_read_len(c->read_idx) <= 1) {
+            buffer_unlock();
+            wait_end(wait_start);
+            return -1;
+        }
+        //广播唤醒所有消费者，数据不够本消费者读取时也会醒来
+        if (wait_start) {
+            STAT_ADD(spurious, 1);
+        } else {
+            wait_start = wait_begin();
+        }
+        buffer_cond_wait(&g_buffer->empty);
     }
+    wait_end(wait_start);
 	int read_idx = 0;
-	if(!bFirst)//如果不是第一次读取数据，则此次直接读取g_buffer.read_idx位置的数据，因为g_buffer.read_idx指针下一次读取的位置
+	int count = 1;
+	if(bLapped)
 	{
-		read_idx = g_buffer.read_idx[consumerId];
+		c->lapped_num++;
+		c->lost_num += g_buffer->cursor - 1 - c->read_seq;
+		bFirst = true;
 	}
-	else//如果第一次读取数据，则将读取指针指向写指针的前一个位置，上面的可读长度判断已经保证此时写指针一定超前读指针了
+	if(!bFirst)//如果不是第一次读取数据，则此次直接读取g_buffer->read_idx位置的数据，因为g_buffer->read_idx指针下一次读取的位置
 	{
-		if(0 == g_buffer.write_idx)
+		read_idx = c->read_idx;
+		count = mutex_read_len(c) - 1;
+		if(count > max_count)
 		{
-			read_idx = g_buffer.size - 1;
+			count = max_count;
 		}
-		else
+		if(count > g_buffer->size - read_idx)
 		{
-			read_idx = g_buffer.write_idx - 1;
+			count = g_buffer->size - read_idx;
 		}
-		g_buffer.read_idx[consumerId] = read_idx;
 	}
-    g_buffer.buf_used_count[read_idx]++;//将使用计数加加
-    assert(g_buffer.buf_used_count[read_idx] <= CONSUMER_NUM);
-    *data = &(g_buffer.buffer[read_idx]);
-    pthread_mutex_unlock(&g_buffer.lock);
-    return 0;
+	else//如果第一次读取数据，则将读取指针指向可读位置的前一个位置，没有依赖时就是写指针的前一个位置，上面的可读长度判断已经保证此时可读位置一定超前读指针了
+	{
+		int64_t barrier = read_barrier(c);
+		read_idx = (int)((barrier - 1) % g_buffer->size);
+		c->read_idx = read_idx;
+		STORE_SEQ_CST(&c->read_seq, barrier - 1);
+		gating_update(consumerId);
+	}
+    for (int i = 0; i < count; i++)
+    {
+        g_buffer->buf_used_count[read_idx + i]++;//将使用计数加加
+        assert(g_buffer->buf_used_count[read_idx + i] <= g_buffer->consumer_max);
+    }
+    *data = &(g_buffer->buffer[read_idx]);
+    buffer_unlock();
+    return count;
+}
+
+//将读指针前移count个，并将使用计数减减，再唤醒生产者
+void release_batch_data(int consumerId,int count)
+{
+    if (MODE_LOCK_FREE == g_mode) {
+        lf_release_batch_data(consumerId, count);
+        return;
+    }
+    ConsumerCursor* c = &g_buffer->consumers[consumerId];
+    buffer_lock();
+    for (int i = 0; i < count; i++)
+    {
+        assert(g_buffer->buf_used_count[c->read_idx + i] > 0);
+        g_buffer->buf_used_count[c->read_idx + i]--;
+    }
+	c->read_idx = (c->read_idx + count) % g_buffer->size;
+    STORE_SEQ_CST(&c->read_seq, c->read_seq + count);
+    gating_update(consumerId);
+    pthread_cond_signal(&g_buffer->full); // 唤醒生产者
+    wait_notify();
+    if (c->dependent_num > 0) {
+        pthread_cond_broadcast(&g_buffer->empty); // 唤醒下游消费者
+        wait_notify();
+    }
+    buffer_unlock();
+}
+
+//读取一个数据，程序退出时返回-1
+int read_data(int consumerId,bool bFirst,MyData** data)
+{
+    return read_batch_data(consumerId, bFirst, 1, data) < 0 ? -1 : 0;
 }
 
 //将读指针前移，并将使用计数减减，再唤醒生产者
 void release_read_data(int consumerId)
 {
-    pthread_mutex_lock(&g_buffer.lock);
-    assert(g_buffer.buf_used_count[g_buffer.read_idx[consumerId]] > 0);
-    g_buffer.buf_used_count[g_buffer.read_idx[consumerId]]--;
-	g_buffer.read_idx[consumerId] = (g_buffer.read_idx[consumerId] + 1) % g_buffer.size;
-    pthread_cond_signal(&g_buffer.full); // 唤醒生产者
-    pthread_mutex_unlock(&g_buffer.lock);
+    release_batch_data(consumerId, 1);
+}
+
+/*
+io_uring异步输出，直接用系统调用，不依赖liburing
+消费者提交整段槽位的写请求后继续读取新数据，写完成后才按读取顺序释放槽位，慢盘不再直接阻塞生产者
+只用于无锁模式的阻塞消费者，有损消费者读到的是会被复用的副本，互斥模式读取时就要释放，都退回fwrite
+*/
+typedef struct {
+    int ring_fd;          // io_uring的文件描述符
+    int fd;               // 输出文件
+    int64_t offset;       // 下一个写请求的文件偏移
+    void* sq_ptr;         // 提交队列的映射
+    size_t sq_len;
+    void* cq_ptr;         // 完成队列的映射，内核支持时与提交队列共用一次映射
+    size_t cq_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    //按提交顺序保存的写请求，完成后从头开始按顺序释放
+    MyData* req_data[URING_DEPTH];
+    int req_count[URING_DEPTH];
+    int64_t req_offset[URING_DEPTH];
+    bool req_done[URING_DEPTH];
+    int req_head;
+    int req_num;
+    bool bError;          // 写失败后不再继续读取
+} UringOutput;
+
+static long io_uring_setup(unsigned entries,struct io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static long io_uring_enter(int ring_fd,unsigned to_submit,unsigned min_complete,unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+//创建io_uring并映射提交和完成队列，内核不支持或被禁止时返回false，调用者退回fwrite
+bool uring_open(UringOutput* u,int fd)
+{
+    struct io_uring_params p;
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->ring_fd = (int)io_uring_setup(URING_DEPTH, &p);
+    if (u->ring_fd < 0) {
+        return false;
+    }
+    u->fd = fd;
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->sq_len = u->cq_len > u->sq_len ? u->cq_len : u->sq_len;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    u->cq_ptr = u->sq_ptr;
+    if (MAP_FAILED != u->sq_ptr && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES);
+    if (MAP_FAILED == u->sq_ptr || MAP_FAILED == u->cq_ptr || MAP_FAILED == (void*)u->sqes) {
+        if (MAP_FAILED != u->sq_ptr) {
+            munmap(u->sq_ptr, u->sq_len);
+        }
+        if (MAP_FAILED != u->cq_ptr && u->cq_ptr != u->sq_ptr) {
+            munmap(u->cq_ptr, u->cq_len);
+        }
+        if (MAP_FAILED != (void*)u->sqes) {
+            munmap(u->sqes, u->sqes_len);
+        }
+        close(u->ring_fd);
+        return false;
+    }
+    char* sq = (char*)u->sq_ptr;
+    char* cq = (char*)u->cq_ptr;
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+void uring_close(UringOutput* u)
+{
+    munmap(u->sqes, u->sqes_len);
+    if (u->cq_ptr != u->sq_ptr) {
+        munmap(u->cq_ptr, u->cq_len);
+    }
+    munmap(u->sq_ptr, u->sq_len);
+    close(u->ring_fd);
+}
+
+//提交第req个写请求，从已写入的长度done开始写剩余部分
+static void uring_submit(UringOutput* u,int req,unsigned done)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned idx = tail & *u->sq_mask;
+    struct io_uring_sqe* sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = u->fd;
+    sqe->addr = (uint64_t)(uintptr_t)((char*)u->req_data[req] + done);
+    sqe->len = sizeof(MyData) * u->req_count[req] - done;
+    sqe->off = u->req_offset[req] + done;
+    sqe->user_data = ((uint64_t)done << 32) | (unsigned)req;
+    u->sq_array[idx] = idx;
+    STORE_RELEASE(u->sq_tail, tail + 1);
+    if (io_uring_enter(u->ring_fd, 1, 0, 0) < 0) {
+        DEBUG_PW("io_uring_enter submit error[%d]\n", errno);
+        u->req_done[req] = true;
+        u->bError = true;
+    }
+}
+
+/*
+处理已完成的写请求，bWait为true时至少等待一个完成
+部分写入时接着提交剩余部分，按提交顺序把开头连续完成的批次一次释放
+*/
+void uring_complete(UringOutput* u,int consumerId,bool bWait)
+{
+    if (bWait && io_uring_enter(u->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && EINTR != errno) {
+        DEBUG_PW("io_uring_enter wait error[%d]\n", errno);
+        u->bError = true;
+    }
+    unsigned head = *u->cq_head;
+    while (head != LOAD_ACQUIRE(u->cq_tail)) {
+        struct io_uring_cqe* cqe = &u->cqes[head & *u->cq_mask];
+        int req = (int)(cqe->user_data & 0xffffffff);
+        unsigned done = (unsigned)(cqe->user_data >> 32);
+        if (cqe->res < 0) {
+            DEBUG_PW("io_uring write error[%d]\n", -cqe->res);
+            u->req_done[req] = true;
+            u->bError = true;
+        } else if (done + cqe->res < sizeof(MyData) * u->req_count[req]) {
+            if (0 == cqe->res) {
+                //没写完却写入了0字节，再提交也不会有进展，按错误处理，不能当作已经写完
+                DEBUG_PW("io_uring short write at %u\n", done);
+                u->req_done[req] = true;
+                u->bError = true;
+            } else {
+                uring_submit(u, req, done + cqe->res);
+            }
+        } else {
+            u->req_done[req] = true;
+        }
+        head++;
+    }
+    STORE_RELEASE(u->cq_head, head);
+    int count = 0;
+    while (u->req_num > 0 && u->req_done[u->req_head]) {
+        count += u->req_count[u->req_head];
+        u->req_head = (u->req_head + 1) % URING_DEPTH;
+        u->req_num--;
+    }
+    if (count > 0) {
+        release_batch_data(consumerId, count);
+    }
+}
+
+//提交一批槽位的写请求，不等待写完成，请求已满时先等待最早的请求完成
+void uring_write(UringOutput* u,int consumerId,MyData* data,int count)
+{
+    while (URING_DEPTH == u->req_num && !u->bError) {
+        uring_complete(u, consumerId, true);
+    }
+    int req = (u->req_head + u->req_num) % URING_DEPTH;
+    u->req_data[req] = data;
+    u->req_count[req] = count;
+    u->req_offset[req] = u->offset;
+    u->req_done[req] = false;
+    u->req_num++;
+    u->offset += sizeof(MyData) * count;
+    uring_submit(u, req, 0);
+    uring_complete(u, consumerId, false);
+}
+
+//等待所有写请求完成并释放槽位，注销之前调用
+void uring_drain(UringOutput* u,int consumerId)
+{
+    while (u->req_num > 0) {
+        uring_complete(u, consumerId, !u->req_done[u->req_head]);
+    }
+}
+
+/*
+发布到消费的延迟统计，每个消费者线程一个直方图，只有这个线程写入，不需要锁
+信号线程随时可以读取，计数用relaxed原子操作，读到的快照中各个桶之间可能差几条记录
+消费者线程注销后重新注册时继续累加到同一个直方图
+*/
+typedef struct {
+    uint64_t bucket[LOGHIST_BUCKETS]; // 桶的划分见loghist.h
+    int64_t count;
+    int64_t sum;
+    int64_t max;
+} CACHE_ALIGNED LatencyHist;
+
+static LatencyHist* g_latency_hist = NULL;//每个消费者线程的延迟直方图，-L时分配
+
+void latency_record(LatencyHist* h,int64_t ns)
+{
+    if (ns < 0) {
+        ns = 0;
+    }
+    int i = loghist_index((uint64_t)ns);
+    STORE_RELAXED(&h->bucket[i], LOAD_RELAXED(&h->bucket[i]) + 1);
+    STORE_RELAXED(&h->sum, LOAD_RELAXED(&h->sum) + ns);
+    if (ns > LOAD_RELAXED(&h->max)) {
+        STORE_RELAXED(&h->max, ns);
+    }
+    STORE_RELAXED(&h->count, LOAD_RELAXED(&h->count) + 1);
+}
+
+//输出每个消费者线程的延迟分布，reason说明是退出时还是收到了哪个信号
+void latency_dump(const char* reason)
+{
+    LatencyHist snap;
+    for (int t = 0; t < g_consumer_num; t++) {
+        LatencyHist* h = &g_latency_hist[t];
+        uint64_t count = 0;
+        for (int i = 0; i < LOGHIST_BUCKETS; i++) {
+            snap.bucket[i] = LOAD_RELAXED(&h->bucket[i]);
+            count += snap.bucket[i];
+        }
+        snap.sum = LOAD_RELAXED(&h->sum);
+        snap.max = LOAD_RELAXED(&h->max);
+        if (0 == count) {
+            printf("latency[%s] consumer[%d] no records\n", reason, t);
+            continue;
+        }
+        printf("latency[%s] consumer[%d] %" PRIu64 " records ns: mean %" PRId64 " p50 %" PRIu64 " p99 %" PRIu64
+            " p99.9 %" PRIu64 " max %" PRId64 "\n", reason, t, count, snap.sum / (int64_t)count,
+            loghist_percentile(snap.bucket, count, 50, snap.max), loghist_percentile(snap.bucket, count, 99, snap.max),
+            loghist_percentile(snap.bucket, count, 99.9, snap.max), snap.max);
+    }
+    fflush(stdout);
+}
+
+static void wait_stats_print(const char* reason,const char* role,int id,const WaitStats* s)
+{
+    WaitStats snap;
+    wait_stats_snapshot(s, &snap);
+    printf("wait[%s] %s[%d] waits %" PRId64 " wakeups %" PRId64 " spurious %" PRId64 " blocked %.1f us (max %.1f)"
+        " notifies %" PRId64 " lock %" PRId64 " contended %" PRId64 " wait %.1f us hold %.1f us (max %.1f)",
+        reason, role, id, snap.waits, snap.wakeups, snap.spurious,
+        snap.blocked_ns / 1e3, snap.blocked_max_ns / 1e3, snap.notifies,
+        snap.lock_num, snap.lock_contended, snap.lock_wait_ns / 1e3,
+        snap.lock_hold_ns / 1e3, snap.lock_hold_max_ns / 1e3);
 }
 
-void simulateData(MyData*pData,int write_idx)
+/*
+输出每个线程的等待统计，消费者还输出当前落后cursor的记录数
+生产者等待多而某个消费者落后最多、很少等待数据时，就是这个消费者在限制生产者
+*/
+void wait_stats_dump(const char* reason)
+{
+    for (int i = 0; i < g_producer_num; i++) {
+        wait_stats_print(reason, "producer", i, &g_producer_stats[i]);
+        printf("\n");
+    }
+    int64_t cursor = LOAD_ACQUIRE(&g_buffer->cursor);
+    for (int t = 0; t < g_consumer_num; t++) {
+        wait_stats_print(reason, "consumer", t, &g_consumer_stats[t]);
+        int consumerId = LOAD_ACQUIRE(&g_thread_consumer[t]);
+        int64_t read_seq = consumerId >= 0 ? LOAD_ACQUIRE(&g_buffer->consumers[consumerId].read_seq) : INT64_MAX;
+        if (read_seq != INT64_MAX) {
+            printf(" lag %" PRId64, cursor - read_seq);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+void stats_dump(const char* reason)
+{
+    if (g_latency) {
+        latency_dump(reason);
+    }
+    if (g_wait_stats) {
+        wait_stats_dump(reason);
+    }
+}
+
+/*
+统计输出的信号线程，所有线程都屏蔽这几个信号，只在这里用sigwait同步接收，输出时不受异步信号安全的限制
+SIGUSR1输出当前的统计后继续运行，SIGINT/SIGTERM输出后按默认方式结束进程
+*/
+static void *stats_signal_thread(void *arg) {
+    sigset_t* set = (sigset_t*)arg;
+    int sig = 0;
+    while (0 == sigwait(set, &sig) && !LOAD_ACQUIRE(&g_stats_exit)) {
+        stats_dump(SIGUSR1 == sig ? "SIGUSR1" : (SIGINT == sig ? "SIGINT" : "SIGTERM"));
+        if (SIGUSR1 != sig) {
+            signal(sig, SIG_DFL);
+            pthread_sigmask(SIG_UNBLOCK, set, NULL);
+            raise(sig);
+        }
+    }
+    return NULL;
+}
+
+//模拟数据的序列号就是缓冲区的序列号，多生产者时消费者看到的也是连续的序列号
+void simulateData(MyData*pData,int write_idx,int64_t seq)
 {
     pData->magic = MAGIC_NUMBER;
-    pData->seqNo = g_seqNo;
+    pData->seqNo = seq;
     pData->write_idx = write_idx;
-    g_seqNo++;
+    pData->publish_ns = 0;
+}
+
+/*
+变长模式的模拟数据，长度由记录编号决定，在16到g_var_max字节之间
+数据的前8字节为记录编号，接着8字节为记录的序列号，其余字节为编号的低8位，消费者据此校验
+*/
+int var_record_length(int64_t ticket)
+{
+    return 16 + (int)((uint64_t)ticket * 2654435761u % (uint64_t)(g_var_max - 15));
+}
+
+void simulateVarData(char* payload,int length,int64_t ticket,int64_t seq)
+{
+    memcpy(payload, &ticket, sizeof(ticket));
+    memcpy(payload + 8, &seq, sizeof(seq));
+    memset(payload + 16, (int)(ticket & 0xff), length - 16);
+}
+
+/*
+变长模式的生产者，每次领取一个记录编号，按编号的长度申请、填充并发布一条记录
+-n限制的是所有生产者一共写入的记录条数
+*/
+static void var_produce(int producerId,FILE* fp)
+{
+    while (LOAD_ACQUIRE(&g_buffer->run_flag)) {
+        int64_t ticket = __atomic_fetch_add(&g_var_claimed, 1, __ATOMIC_RELAXED);
+        if (g_max_records > 0 && ticket >= g_max_records) {
+            break;
+        }
+        int length = var_record_length(ticket);
+        char* payload = NULL;
+        int64_t seq = 0;
+        int total = var_get_write_batch(producerId, length, &payload, &seq);
+        if (total < 0) {
+            break;
+        }
+        simulateVarData(payload, length, ticket, seq + total - var_units(length));
+        if (fp && fwrite(payload - sizeof(VarRecord), sizeof(VarRecord) + length, 1, fp) != 1) {
+            DEBUG_PN("fwrite write var record error[%d]\n", errno);
+        }
+        if (g_latency) {
+            var_set_publish_ns(payload, monotonic_ns());
+        }
+        write_batch_data(seq, total);
+        __atomic_add_fetch(&g_var_produced, 1, __ATOMIC_RELAXED);
+    }
 }
 
+/*
+生产者线程，多生产者时每个生产者写自己的文件，申请到的序列号交错，发布后消费者看到的仍然是一个有序的流
+最后一个退出的生产者负责通知消费者退出
+*/
 static void *producer(void *arg) {
+    int producerId = *((int*)arg);
     char producer_file_path[256];
-    snprintf(producer_file_path,sizeof(producer_file_path),"%s/producer.bin",g_output_dir);
-    if ((g_simulate_fp = fopen(producer_file_path, "w")) == NULL)
+    if (1 == g_producer_num) {
+        snprintf(producer_file_path,sizeof(producer_file_path),"%s/producer.bin",g_output_dir);
+    } else {
+        snprintf(producer_file_path,sizeof(producer_file_path),"%s/producer_%d.bin",g_output_dir,producerId);
+    }
+    FILE* fp = NULL;//模拟数据写入的文件，持久化模式下缓冲区本身就在文件中，不再另写一份
+    bool bJournal = !g_buffer->bPersist;
+    if (bJournal && (fp = fopen(producer_file_path, "w")) == NULL)
     {
         DEBUG_PN("\n Can't open simulate file[%s][%s]\n", g_output_dir,producer_file_path);
-        g_run_flag = 0;
-        return NULL;
+        g_buffer->run_flag = 0;
+    }
+	DEBUG_PN("start producer[%s]\n", bJournal ? producer_file_path : g_persist_path);
+    if (g_wait_stats) {
+        t_wait_stats = &g_producer_stats[producerId];
     }
-#if 1
-	//等待消费者线程全部启动后，再开始生产
-	for (int i = 0; i < CONSUMER_NUM; i++) {
-		DEBUG_PN("sem_wait[%d]1\n",i);
-		sem_wait(&g_consumerSema[i]);
-		DEBUG_PN("sem_wait[%d]2\n",i);
-	}
-#endif		
-	DEBUG_PN("start producer[%s]\n", producer_file_path);
     int ret = 0;
     MyData* pData = NULL;
     int write_idx = 0;
-    while (g_run_flag) {
-        get_write_pos(&pData,&write_idx);
-        simulateData(pData,write_idx);
-        ret = fwrite(pData, sizeof(MyData), 1, g_simulate_fp);
-        if (ret < 0)
-        {
-            DEBUG_PN("fwrite write nread len error[%d][%d]\n", ret, errno);
+    int64_t seq = 0;
+    if (g_var_max && (fp || !bJournal)) {
+        var_produce(producerId, fp);
+    }
+    while (!g_var_max && (fp || !bJournal) && g_buffer->run_flag) {
+        int count = get_write_batch(producerId,g_batch_size,&pData,&write_idx,&seq);
+        if (count <= 0) {
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            simulateData(&pData[i],write_idx + i,seq + i);
         }
-        write_one_data();
+        if (fp) {
+            ret = fwrite(pData, sizeof(MyData), count, fp);
+            if (ret < 0)
+            {
+                DEBUG_PN("fwrite write nread len error[%d][%d]\n", ret, errno);
+            }
+        }
+        if (g_latency) {
+            //紧挨着发布打时间戳，延迟只包含在缓冲区中等待和消费者读取的时间
+            int64_t now = monotonic_ns();
+            for (int i = 0; i < count; i++) {
+                pData[i].publish_ns = now;
+            }
+        }
+        write_batch_data(seq,count);
     }
-    if (g_simulate_fp)
+    if (__atomic_sub_fetch(&g_producer_running, 1, __ATOMIC_SEQ_CST) == 0) {
+        //通知消费者退出，阻塞在条件变量上或已停车的消费者需要唤醒
+        STORE_SEQ_CST(&g_buffer->run_flag, 0);
+        lf_wake_consumers();
+        buffer_lock();
+        pthread_cond_broadcast(&g_buffer->empty);
+        buffer_unlock();
+    }
+    if (fp)
     {
-        fclose(g_simulate_fp);
-        g_simulate_fp = NULL;
+        fclose(fp);
     }
     return NULL;
 }
 
+/*
+变长模式的消费者读取一批记录，校验后把记录(包括头部)直接从环中写到文件，写完再释放
+单生产者时记录编号必须连续，多生产者时各生产者领取编号和申请槽位的顺序可能不同，只校验每条记录自身
+返回读到的记录条数，生产者停止后读完时返回-1
+*/
+int var_consume_batch(int consumerId,FILE* fp,int max_num,LatencyHist* pLatency,bool* bFirst,uint64_t* lastSeqNo)
+{
+    VarView views[VAR_VIEW_MAX];
+    int units = 0;
+    int count = var_read_batch(consumerId, views, max_num < VAR_VIEW_MAX ? max_num : VAR_VIEW_MAX, &units);
+    if (count < 0) {
+        return -1;
+    }
+    int64_t now = pLatency ? monotonic_ns() : 0;
+    for (int i = 0; i < count; i++) {
+        int64_t ticket = 0;
+        int64_t seq = 0;
+        memcpy(&ticket, views[i].data, sizeof(ticket));
+        memcpy(&seq, views[i].data + 8, sizeof(seq));
+        assert(seq == views[i].seq && views[i].length == var_record_length(ticket));
+        if (!*bFirst && 1 == g_buffer->producer_num) {
+            assert(*lastSeqNo + 1 == (uint64_t)ticket);
+        }
+        *bFirst = false;
+        *lastSeqNo = (uint64_t)ticket;
+        if (pLatency && views[i].publish_ns) {
+            latency_record(pLatency, now - views[i].publish_ns);
+        }
+        if (fwrite(views[i].data - sizeof(VarRecord), sizeof(VarRecord) + views[i].length, 1, fp) != 1) {
+            DEBUG_PD("fwrite var record error[%d]\n", errno);
+            release_batch_data(consumerId, units);
+            return -1;
+        }
+    }
+    if (g_buffer->bPersist) {
+        fflush(fp);
+    }
+    release_batch_data(consumerId, units);
+    return count;
+}
+
+/*
+消费者线程，注册后一直读取，直到生产者退出
+设置了g_consumer_lifetime时，每读取这么多条记录就注销一次再重新注册，模拟运行时增删下游
+*/
 static void *consumer(void *arg) {
-    int consumerId = *((int*)arg);
-	bool bFirst = true;
+    int threadId = *((int*)arg);
     char consumer_file_path[128];
-    snprintf(consumer_file_path,sizeof(consumer_file_path),"%s/consumer_%d.bin",g_output_dir,consumerId);
+    snprintf(consumer_file_path,sizeof(consumer_file_path),"%s/consumer_%d.bin",g_output_dir,threadId);
     FILE* fp = NULL;
 
-    if ((fp = fopen(consumer_file_path, "wb")) == NULL)
+    //持久化模式下消费者从上次的进度继续，输出接在上次的文件后面
+    if ((fp = fopen(consumer_file_path, g_persist_path[0] ? "ab" : "wb")) == NULL)
     {
         DEBUG_PW("Can't open buffer[%s][%s]\n",g_output_dir,consumer_file_path);
-        g_run_flag = 0;
+        g_buffer->run_flag = 0;
+        sem_post(&g_produceSema);
         return NULL;
     }
-#if 1
-	//让生产者开始生产
-	sem_post(&g_consumerSema[consumerId]);
-#endif
-	DEBUG_PN("start consumer[%d] = [%s]\n",consumerId, consumer_file_path);
+    if (g_wait_stats) {
+        t_wait_stats = &g_consumer_stats[threadId];
+    }
     int ret = 0;
+    bool bStop = false;
+    bool bAttached = false;
+    UringOutput uring;
+    UringOutput* pUring = NULL;
+    if (g_uring_output && MODE_LOCK_FREE == g_mode && OVERRUN_BLOCK == g_consumer_policy[threadId] && !g_var_max) {
+        if (uring_open(&uring, fileno(fp))) {
+            pUring = &uring;
+        } else {
+            DEBUG_PW("consumer[%d] io_uring unavailable[%d], fall back to fwrite\n",threadId,errno);
+        }
+    }
     MyData* pData = NULL;
-    while (g_run_flag) {
-		read_data(consumerId,bFirst,&pData);
-        if(!bFirst)
-        {
-            assert(g_lastSeqNo[consumerId] + 1 == pData->seqNo);
+    uint64_t lastSeqNo = 0;//保存上次包序号，用于debug
+    LatencyHist* pLatency = g_latency ? &g_latency_hist[threadId] : NULL;
+    int64_t lapped_num = 0;
+    int64_t lost_num = 0;
+    while (!bStop) {
+        //等待所有上游线程注册后，再依赖它们当前的消费者编号注册
+        int deps[CONSUMER_DEP_MAX];
+        int dep_num = g_consumer_dep_num[threadId];
+        for (int i = 0; i < dep_num; i++) {
+            int upThread = g_consumer_deps[threadId * CONSUMER_DEP_MAX + i];
+            while ((deps[i] = LOAD_ACQUIRE(&g_thread_consumer[upThread])) < 0 && LOAD_ACQUIRE(&g_buffer->run_flag)) {
+                usleep(1000);
+            }
         }
-		else
-		{
-			bFirst = false;
-		}
-        g_lastSeqNo[consumerId] = pData->seqNo;
-        ret = fwrite(pData, sizeof(MyData), 1, fp);
-
-        if (ret < 0)
-        {
-            DEBUG_PD("fwrite write nread len error[%d][%d]\n", ret, errno);
+        int consumerId = -1;
+        if (LOAD_ACQUIRE(&g_buffer->run_flag)) {
+            consumerId = consumer_attach(g_consumer_wait[threadId],g_consumer_policy[threadId],deps,dep_num,
+                g_persist_path[0] ? threadId : -1);
+        }
+        if (consumerId < 0) {
+            DEBUG_PW("consumer[%d] attach failed\n",threadId);
             break;
         }
-        release_read_data(consumerId);
+        STORE_RELEASE(&g_thread_consumer[threadId], consumerId);
+#if 1
+        if (!bAttached) {
+            //让生产者开始生产
+            sem_post(&g_produceSema);
+            bAttached = true;
+        }
+#endif
+        DEBUG_PN("start consumer[%d] id[%d] = [%s]\n",threadId, consumerId, consumer_file_path);
+        bool bFirst = true;
+        int64_t consumed = 0;
+        while (0 == g_consumer_lifetime || consumed < g_consumer_lifetime) {
+            //一次取出所有已发布的连续数据，落后的消费者可以批量追赶
+            int max_count = g_buffer->size;
+            if (g_consumer_lifetime > 0 && g_consumer_lifetime - consumed < max_count) {
+                max_count = (int)(g_consumer_lifetime - consumed);
+            }
+            if (g_var_max) {
+                int count = var_consume_batch(consumerId, fp, max_count, pLatency, &bFirst, &lastSeqNo);
+                if (count < 0) {
+                    bStop = true;
+                    break;
+                }
+                consumed += count;
+                if (g_consumer_delay[threadId] > 0) {
+                    usleep(g_consumer_delay[threadId]);
+                }
+                continue;
+            }
+            if (pUring && pUring->req_num > 0 && !lf_read_ready(consumerId)) {
+                //没有新数据时先等写完成释放槽位，不能带着未释放的槽位停车，否则生产者可能一直等待
+                uring_complete(pUring, consumerId, true);
+                continue;
+            }
+            int64_t lapped = g_buffer->consumers[consumerId].lapped_num;
+            int count = read_batch_data(consumerId,bFirst,max_count,&pData);
+            if (count < 0) {
+                bStop = true;
+                break;
+            }
+            if (lapped != g_buffer->consumers[consumerId].lapped_num) {
+                bFirst = true;//被套圈后从最新的记录重新开始，序号不再连续
+            }
+            if (pLatency) {
+                //生产者没有打时间戳的记录(比如持久化文件中上次运行留下的)不统计
+                int64_t now = monotonic_ns();
+                for (int i = 0; i < count; i++) {
+                    if (pData[i].publish_ns) {
+                        latency_record(pLatency, now - pData[i].publish_ns);
+                    }
+                }
+            }
+            for (int i = 0; i < count; i++)
+            {
+                if(!bFirst)
+                {
+                    assert(lastSeqNo + 1 == pData[i].seqNo);
+                }
+                else
+                {
+                    bFirst = false;
+                }
+                lastSeqNo = pData[i].seqNo;
+            }
+            consumed += count;
+            if (pUring) {
+                uring_write(pUring, consumerId, pData, count);
+                bStop = pUring->bError;
+            } else {
+                ret = fwrite(pData, sizeof(MyData), count, fp);
+
+                if (ret < 0)
+                {
+                    DEBUG_PD("fwrite write nread len error[%d][%d]\n", ret, errno);
+                    bStop = true;
+                }
+                if (g_buffer->bPersist) {
+                    //持久化的进度不能超过已经交给内核的输出，进程崩溃后最多重复输出一批，不会丢失
+                    fflush(fp);
+                }
+                release_batch_data(consumerId,count);
+            }
+            if (bStop) {
+                break;
+            }
+            if (g_consumer_delay[threadId] > 0) {
+                usleep(g_consumer_delay[threadId]);
+            }
+        }
+        if (pUring) {
+            uring_drain(pUring, consumerId);
+        }
+        lapped_num += g_buffer->consumers[consumerId].lapped_num;
+        lost_num += g_buffer->consumers[consumerId].lost_num;
+        STORE_RELEASE(&g_thread_consumer[threadId], -1);
+        consumer_detach(consumerId);
+    }
+    if (!bAttached) {
+        sem_post(&g_produceSema);//注册失败也要通知，否则主线程一直等待
+    }
+    if (OVERRUN_LOSSY == g_consumer_policy[threadId]) {
+        printf("consumer[%d] lossy: lapped %" PRId64 " times, lost %" PRId64 " records\n",
+            threadId, lapped_num, lost_num);
+    }
+    if (pUring) {
+        uring_close(pUring);
     }
     fclose(fp);
     return NULL;
 }
 
 int main(int argc, char** argv) {
-	if(argc != 2)
+	int opt = 0;
+	int consumer_arg_num = 0;
+	char* consumer_opts = (char*)malloc(argc);//-w -o -d参数在知道消费者个数后再按顺序解析
+	char** consumer_args = (char**)malloc(sizeof(char*) * argc);
+	while ((opt = getopt(argc, argv, "m:n:b:p:w:o:d:g:s:c:C:l:uS:A:P:LTV:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			if (0 == strcmp(optarg, "mutex")) {
+				g_mode = MODE_MUTEX;
+			} else if (0 == strcmp(optarg, "lockfree")) {
+				g_mode = MODE_LOCK_FREE;
+			} else {
+				printf("unknown mode %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'n':
+			g_max_records = atoll(optarg);
+			break;
+		case 'b':
+			g_batch_size = atoi(optarg);
+			if (g_batch_size < 1) {
+				g_batch_size = 1;
+			}
+			break;
+		case 'w':
+		case 'o':
+		case 'd':
+		case 'g':
+			consumer_opts[consumer_arg_num] = (char)opt;
+			consumer_args[consumer_arg_num++] = optarg;
+			break;
+		case 'p':
+			g_producer_num = atoi(optarg);
+			break;
+		case 'u':
+			g_uring_output = true;
+			break;
+		case 's':
+			g_buffer_size = atoi(optarg);
+			break;
+		case 'c':
+			g_consumer_num = atoi(optarg);
+			break;
+		case 'C':
+			g_consumer_max = atoi(optarg);
+			break;
+		case 'l':
+			g_consumer_lifetime = atoll(optarg);
+			break;
+		case 'S':
+		case 'A':
+			snprintf(g_shm_name, sizeof(g_shm_name), "%s", optarg);
+			g_shm_attach = ('A' == opt);
+			break;
+		case 'P':
+			snprintf(g_persist_path, sizeof(g_persist_path), "%s", optarg);
+			break;
+		case 'L':
+			g_latency = true;
+			break;
+		case 'T':
+			g_wait_stats = true;
+			break;
+		case 'V':
+			g_var_max = atoi(optarg);
+			break;
+		default:
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (0 == g_consumer_max) {
+		g_consumer_max = g_consumer_num;
+	}
+	if (g_shm_attach) {
+		//只注册消费者的进程跟随创建者的无锁模式
+		g_mode = MODE_LOCK_FREE;
+	}
+	if(optind != argc - 1 || ((g_shm_name[0] || g_persist_path[0]) && MODE_LOCK_FREE != g_mode)
+		|| (g_shm_name[0] && g_persist_path[0]) || (g_var_max && (MODE_LOCK_FREE != g_mode || g_var_max < 16)) || g_buffer_size < 4 || g_producer_num < 1 || g_consumer_num < 0 || g_consumer_max < g_consumer_num)
 	{
-		printf("usage: %s output_dir\n",argv[0]);
+		printf("usage: %s [-m mutex|lockfree] [-p producers] [-n records] [-b batch] [-w [p:|consumer:]spin|yield|park|adaptive]...\n"
+			"\t[-o [consumer:]block|lossy]... [-d [consumer:]usec]... [-g consumer:upstream[,upstream]...]...\n"
+			"\t[-s buffer_size] [-c consumers] [-C max_consumers] [-l consumer_lifetime] [-u] [-L] [-T] [-V max_record_bytes]\n"
+			"\t[-S shm_name | -A shm_name | -P ring_file] output_dir\n",argv[0]);
+		return -1;
+	}
+	g_consumer_wait = (int*)malloc(sizeof(int) * (g_consumer_num + 1));
+	g_consumer_policy = (int*)malloc(sizeof(int) * (g_consumer_num + 1));
+	g_consumer_delay = (int*)malloc(sizeof(int) * (g_consumer_num + 1));
+	g_consumer_deps = (int*)malloc(sizeof(int) * CONSUMER_DEP_MAX * (g_consumer_num + 1));
+	g_consumer_dep_num = (int*)malloc(sizeof(int) * (g_consumer_num + 1));
+	g_thread_consumer = (int*)malloc(sizeof(int) * (g_consumer_num + 1));
+	for (int i = 0; i < g_consumer_num; i++) {
+		g_consumer_wait[i] = WAIT_PARK;
+		g_consumer_policy[i] = OVERRUN_BLOCK;
+		g_consumer_delay[i] = 0;
+		g_consumer_dep_num[i] = 0;
+		g_thread_consumer[i] = -1;
+	}
+	for (int n = 0; n < consumer_arg_num; n++) {
+		//不带编号设置所有消费者，消费者编号:值 设置单个消费者，-w p:策略 设置生产者，-w 策略 同时设置生产者
+		char* arg = consumer_args[n];
+		int ret = 0;
+		if ('w' == consumer_opts[n] && 0 == strncmp(arg, "p:", 2)) {
+			ret = g_producer_wait = parse_wait_strategy(arg + 2);
+		} else if ('w' == consumer_opts[n]) {
+			ret = parse_consumer_option(arg, parse_wait_strategy, g_consumer_wait);
+			if (ret >= 0 && NULL == strchr(arg, ':')) {
+				g_producer_wait = ret;
+			}
+		} else if ('o' == consumer_opts[n]) {
+			ret = parse_consumer_option(arg, parse_overrun_policy, g_consumer_policy);
+		} else if ('g' == consumer_opts[n]) {
+			ret = parse_consumer_deps(arg);
+		} else {
+			ret = parse_consumer_option(arg, parse_delay, g_consumer_delay);
+		}
+		if (ret < 0) {
+			printf("bad option -%c %s\n", consumer_opts[n], arg);
+			return -1;
+		}
+	}
+	free(consumer_opts);
+	free(consumer_args);
+	if (check_consumer_deps() < 0 || check_var_mode() < 0) {
 		return -1;
 	}
-    snprintf(g_output_dir, sizeof(g_output_dir), "%s",argv[1]);
+    snprintf(g_output_dir, sizeof(g_output_dir), "%s",argv[optind]);
     // 检查目录是否存在
     if (access(g_output_dir, F_OK) == -1) {
         // 目录不存在，则创建目录
@@ -292,22 +2562,64 @@ int main(int argc, char** argv) {
         }
     }
 
-    g_seqNo = 0;//模拟数据序列号
-
-    // 初始化缓冲区
-    g_buffer.buffer = (MyData *)malloc(sizeof(MyData) * BUFFER_SIZE);
-    memset(g_buffer.buffer,0,sizeof(MyData) * BUFFER_SIZE);
-    g_buffer.buf_used_count  = (int *)malloc(sizeof(int) * BUFFER_SIZE);
-    memset(g_buffer.buf_used_count,0,sizeof(int) * BUFFER_SIZE);
-    g_buffer.size = BUFFER_SIZE;
-    g_buffer.write_idx = 0;
-    memset(g_buffer.read_idx,0,sizeof(g_buffer.read_idx));
-    pthread_mutex_init(&g_buffer.lock, NULL);
-    pthread_cond_init(&g_buffer.full, NULL);
-    pthread_cond_init(&g_buffer.empty, NULL);
+    // 初始化缓冲区，-A时注册到其它进程创建的共享内存，生产者个数和缓冲区大小都跟随创建者
+    if (g_shm_attach) {
+        g_buffer = buffer_attach(g_shm_name);
+        if (g_buffer && g_consumer_num > g_buffer->consumer_max) {
+            printf("%d consumers exceed shared consumer table %d\n", g_consumer_num, g_buffer->consumer_max);
+            munmap(g_buffer->base, g_buffer->length);
+            return -1;
+        }
+    } else if (g_persist_path[0]) {
+        g_buffer = buffer_open_file(g_persist_path, g_buffer_size, g_consumer_max, g_producer_num);
+    } else {
+        g_buffer = buffer_create(g_shm_name, g_buffer_size, g_consumer_max, g_producer_num);
+    }
+    if (NULL == g_buffer) {
+        return -1;
+    }
+    if (g_shm_attach) {
+        g_buffer_size = g_buffer->size;
+        g_consumer_max = g_buffer->consumer_max;
+        g_producer_num = 0;
+        g_var_max = g_buffer->var_max;
+        if (check_var_mode() < 0) {
+            munmap(g_buffer->base, g_buffer->length);
+            return -1;
+        }
+    }
+    g_producer_running = g_producer_num;
+    g_start_seq = g_buffer->cursor;
 
+    //必须在创建消费者之前初始化，消费者注册后就会sem_post
     sem_init(&g_produceSema, 0, 0);
 
+    //-L或-T时在创建其它线程之前屏蔽信号，之后创建的线程都继承，只由信号线程接收
+    sigset_t stats_signals;
+    pthread_t statsThreadId;
+    if (g_latency) {
+        if (0 != posix_memalign((void**)&g_latency_hist, CACHE_LINE, sizeof(LatencyHist) * (g_consumer_num + 1))) {
+            return -1;
+        }
+        memset(g_latency_hist, 0, sizeof(LatencyHist) * (g_consumer_num + 1));
+    }
+    if (g_wait_stats) {
+        if (0 != posix_memalign((void**)&g_producer_stats, CACHE_LINE, sizeof(WaitStats) * (g_producer_num + 1))
+            || 0 != posix_memalign((void**)&g_consumer_stats, CACHE_LINE, sizeof(WaitStats) * (g_consumer_num + 1))) {
+            return -1;
+        }
+        memset(g_producer_stats, 0, sizeof(WaitStats) * (g_producer_num + 1));
+        memset(g_consumer_stats, 0, sizeof(WaitStats) * (g_consumer_num + 1));
+    }
+    if (g_latency || g_wait_stats) {
+        sigemptyset(&stats_signals);
+        sigaddset(&stats_signals, SIGUSR1);
+        sigaddset(&stats_signals, SIGINT);
+        sigaddset(&stats_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &stats_signals, NULL);
+        pthread_create(&statsThreadId, NULL, stats_signal_thread, &stats_signals);
+    }
+
 	//设置线程实时优先级
     struct sched_param param;
     pthread_attr_t attr;
@@ -317,33 +2629,77 @@ int main(int argc, char** argv) {
     param.sched_priority = 99;
     pthread_attr_setschedparam(&attr, &param);
 	
-    // 创建生产者线程
-    pthread_t producerThreadId;
-    pthread_create(&producerThreadId, &attr, producer, NULL);
-
-    param.sched_priority = 99;
-    pthread_attr_setschedparam(&attr, &param);
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     // 创建多个消费者线程
-    pthread_t consumerThreadIds[CONSUMER_NUM];
-    int consumerId[CONSUMER_NUM] = {0};
-    for (int i = 0; i < CONSUMER_NUM; i++) {
-		sem_init(&g_consumerSema[i], 0, 0);
+    pthread_t* consumerThreadIds = (pthread_t*)malloc(sizeof(pthread_t) * (g_consumer_num + 1));
+    int* consumerId = (int*)malloc(sizeof(int) * (g_consumer_num + 1));
+    for (int i = 0; i < g_consumer_num; i++) {
         consumerId[i] = i;
         pthread_create(&consumerThreadIds[i], &attr, consumer, &consumerId[i]);
     }
+#if 1
+	//等待启动时的消费者都注册后，再开始生产，之后消费者可以随时注册和注销
+	for (int i = 0; i < g_consumer_num; i++) {
+		DEBUG_PN("sem_wait[%d]1\n",i);
+		sem_wait(&g_produceSema);
+		DEBUG_PN("sem_wait[%d]2\n",i);
+	}
+#endif
+
+    param.sched_priority = 99;
+    pthread_attr_setschedparam(&attr, &param);
+    // 创建生产者线程
+    pthread_t* producerThreadIds = (pthread_t*)malloc(sizeof(pthread_t) * g_producer_num);
+    int* producerId = (int*)malloc(sizeof(int) * g_producer_num);
+    for (int i = 0; i < g_producer_num; i++) {
+        producerId[i] = i;
+        pthread_create(&producerThreadIds[i], &attr, producer, &producerId[i]);
+    }
     
     // 等待生产者和消费者线程结束
-    pthread_join(producerThreadId, NULL);
-    for (int i = 0; i < CONSUMER_NUM; i++) {
+    for (int i = 0; i < g_producer_num; i++) {
+        pthread_join(producerThreadIds[i], NULL);
+    }
+    for (int i = 0; i < g_consumer_num; i++) {
         pthread_join(consumerThreadIds[i], NULL);
     }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double elapsed = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    if (g_shm_attach) {
+        printf("shm[%s] %d consumers finished at cursor %" PRId64 " in %.3f s\n",
+            g_shm_name, g_consumer_num, g_buffer->cursor, elapsed);
+    } else if (g_var_max) {
+        printf("mode[lockfree] %d producers produced %" PRId64 " variable records (%" PRId64 " slots of %d bytes)"
+            " in %.3f s, %.0f records/s\n", g_producer_num, g_var_produced, g_buffer->cursor - g_start_seq, VAR_UNIT,
+            elapsed, g_var_produced / elapsed);
+    } else {
+        printf("mode[%s] %d producers produced %" PRId64 " records in %.3f s, %.0f records/s\n",
+            MODE_LOCK_FREE == g_mode ? "lockfree" : "mutex", g_producer_num, g_buffer->cursor - g_start_seq,
+            elapsed, (g_buffer->cursor - g_start_seq) / elapsed);
+    }
+    if (g_latency || g_wait_stats) {
+        STORE_RELEASE(&g_stats_exit, 1);
+        pthread_kill(statsThreadId, SIGUSR1);
+        pthread_join(statsThreadId, NULL);
+        stats_dump("exit");
+        free(g_latency_hist);
+        free(g_producer_stats);
+        free(g_consumer_stats);
+    }
     
     // 销毁互斥锁和条件变量，释放缓冲区内存
-    pthread_mutex_destroy(&g_buffer.lock);
-    pthread_cond_destroy(&g_buffer.full);
-    pthread_cond_destroy(&g_buffer.empty);
-    free(g_buffer.buffer);
-    free(g_buffer.buf_used_count);
+    buffer_destroy(g_buffer);
+    free(producerThreadIds);
+    free(producerId);
+    free(consumerThreadIds);
+    free(consumerId);
+    free(g_consumer_wait);
+    free(g_consumer_policy);
+    free(g_consumer_delay);
+    free(g_consumer_deps);
+    free(g_consumer_dep_num);
+    free(g_thread_consumer);
     return 0;
 }
 
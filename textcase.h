@@ -0,0 +1,124 @@
+/* textcase.h
+
+   ASCII case conversion kernels for the prodcons text pipeline,
+   shared by textpipe.h and upperbench.c.
+
+   Once I/O is batched the per-byte case conversion is the consumer's
+   bottleneck, so it is done by a kernel chosen at run time: AVX2
+   (32 bytes per step) or SSE2 (16 bytes per step) when the CPU has
+   them, else a scalar loop.  All kernels map only ASCII 'a'..'z',
+   which is what toupper() does in the C locale these programs run in.
+*/
+
+#ifndef TEXTCASE_H
+#define TEXTCASE_H
+
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define TP_X86 1
+#include <immintrin.h>
+#endif
+
+/* The case conversion kernels shift p[0..n) to upper case in place.
+
+   The vector kernels find 'a'..'z' with one signed compare: adding
+   0x80 - 'a' moves 'a' to -128, so exactly the lower case letters
+   end up below -128 + 26.  Their mask selects the 0x20 bit to clear.
+ */
+static void tp_upper_scalar(char *p, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++) {
+    if ((unsigned char) (p[i] - 'a') < 26)
+      p[i] -= 'a' - 'A';
+  }
+}
+
+#ifdef TP_X86
+__attribute__((target("sse2")))
+static void tp_upper_sse2(char *p, size_t n)
+{
+  const __m128i shift = _mm_set1_epi8((char) (0x80 - 'a'));
+  const __m128i limit = _mm_set1_epi8((char) (-128 + 26));
+  const __m128i bit = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+    __m128i lower = _mm_cmplt_epi8(_mm_add_epi8(x, shift), limit);
+    _mm_storeu_si128((__m128i *) (p + i), _mm_xor_si128(x, _mm_and_si128(lower, bit)));
+  }
+  tp_upper_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void tp_upper_avx2(char *p, size_t n)
+{
+  const __m256i shift = _mm256_set1_epi8((char) (0x80 - 'a'));
+  const __m256i limit = _mm256_set1_epi8((char) (-128 + 26));
+  const __m256i bit = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+    __m256i lower = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(x, shift));
+    _mm256_storeu_si256((__m256i *) (p + i), _mm256_xor_si256(x, _mm256_and_si256(lower, bit)));
+  }
+  tp_upper_sse2(p + i, n - i);
+}
+#endif
+
+typedef struct tp_kernel {
+  const char *name;
+  void (*upper)(char *p, size_t n);
+  int (*supported)(void);
+} tp_kernel_t;
+
+static int tp_always(void)
+{
+  return 1;
+}
+
+#ifdef TP_X86
+static int tp_has_sse2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+static int tp_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+/* the kernels, fastest first */
+static const tp_kernel_t tp_kernels[] = {
+#ifdef TP_X86
+  { "avx2", tp_upper_avx2, tp_has_avx2 },
+  { "sse2", tp_upper_sse2, tp_has_sse2 },
+#endif
+  { "scalar", tp_upper_scalar, tp_always },
+  { NULL, NULL, NULL }
+};
+
+/* tp_upper is the kernel in use, set by tp_select_upper */
+static void (*tp_upper)(char *p, size_t n) = tp_upper_scalar;
+
+/* tp_select_upper picks the kernel by name, or the fastest one this
+   CPU supports if name is NULL.  It returns the kernel, or NULL if
+   the named kernel is unknown or not supported here.
+ */
+static const tp_kernel_t *tp_select_upper(const char *name)
+{
+  const tp_kernel_t *k;
+  for (k = tp_kernels; k->name != NULL; k++) {
+    if ((name == NULL || strcmp(name, k->name) == 0) && k->supported()) {
+      tp_upper = k->upper;
+      return k;
+    }
+  }
+  return NULL;
+}
+
+#endif /* TEXTCASE_H */
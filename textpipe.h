@@ -0,0 +1,734 @@
+/* textpipe.h
+
+   High-throughput modes for the prodcons text pipeline, shared by
+   prodcons.c and prodcons_ex.c.
+
+   The teaching version moves one character at a time: getc() into a
+   256-byte line slot, then putc(toupper()) out of it.  That is a few
+   function calls per byte, which dominates on large inputs.
+
+   The bulk mode keeps the same structure -- a ring of slots guarded
+   by a mutex and two condition variables, one producer and one
+   consumer -- but each slot is a large block of whole lines:
+
+   - the producer fills a block with read(), finds the last newline
+     with a vectorized scan, and hands over everything up to and
+     including it; the partial line after it is copied to the front
+     of the next block;
+   - the consumer converts the whole block in place and writes it
+     with a single write().
+
+   Lines longer than a block are handed over in block-sized pieces,
+   so the output is always byte-for-byte the same as the input
+   shifted to upper case.
+
+   The arena mode keeps every line whole, however long.  The producer
+   reads into a few large arena blocks and enqueues only descriptors
+   (block, offset, length) of the complete lines in them; the line
+   bytes are never copied into a slot.  Each block counts the
+   descriptors still pointing into it and goes back to the free pool
+   when the consumer has written the last of them.  The only copy
+   left is the partial line at the end of a full block, which moves
+   to the front of the next one.  That block is of the normal size
+   unless the partial line takes more than half of one, in which case
+   it is twice the length of the partial line, so a line of any length
+   eventually fits.
+
+   The parallel mode runs the transform on several worker threads.
+   The producer fills blocks of whole lines as in the bulk mode and
+   numbers them in input order.  Any idle worker takes the oldest
+   block not yet claimed and converts it; a writer thread then writes
+   the converted blocks strictly by number, so the output is the same
+   as with a single consumer however the workers are scheduled.
+   The blocks live in a ring indexed by their number, which bounds
+   how far the workers can run ahead of the writer.
+
+   Once I/O is batched the per-byte case conversion is the consumer's
+   bottleneck, so it is done by one of the vector kernels in
+   textcase.h, chosen at run time.
+
+   tp_main parses the options both programs take and runs the mode
+   they ask for:
+
+     -b                the bulk mode
+     -a                the arena mode
+     -j workers        the parallel mode with that many workers
+     -k avx2|sse2|scalar
+                       forces the case conversion kernel, which
+                       otherwise is the fastest one the CPU supports
+
+   Without -a, -b or -j the caller runs its own teaching version.
+*/
+
+#ifndef TEXTPIPE_H
+#define TEXTPIPE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "textcase.h"
+
+#define TP_BNUM 4                  /* number of blocks in the ring */
+#define TP_BLOCK_SIZE (1 << 20)    /* bytes per block */
+
+typedef struct tp_block {
+  char *data;
+  size_t len;                /* bytes of whole lines in the block */
+  int eof;                   /* set on the last block, which may be empty */
+} tp_block_t;
+
+typedef struct tp_buffer {
+  pthread_mutex_t lock;      /* protects count */
+  pthread_cond_t
+    new_data_cond,           /* to wait when the ring is empty */
+    new_space_cond;          /* to wait when the ring is full */
+  tp_block_t b[TP_BNUM];
+  int in,                    /* next block to fill, producer only */
+      out,                   /* next block to drain, consumer only */
+      count;                 /* the number of blocks occupied */
+  int error;                 /* errno of a failed read() or write() */
+} tp_buffer_t;
+
+/* tp_last_newline returns a pointer to the last '\n' in p[0..n),
+   or NULL if there is none.  With SSE2 it compares 16 bytes at a
+   time, scanning backwards from the end of the block.
+ */
+static const char *tp_last_newline(const char *p, size_t n)
+{
+#ifdef TP_X86
+  const __m128i nl = _mm_set1_epi8('\n');
+  while (n >= 16) {
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_loadu_si128((const __m128i *) (p + n - 16)), nl));
+    if (mask)
+      return p + n - 16 + (31 - __builtin_clz(mask));
+    n -= 16;
+  }
+#endif
+  while (n > 0) {
+    if (p[--n] == '\n')
+      return p + n;
+  }
+  return NULL;
+}
+
+/* tp_write_all writes the whole block, retrying short writes.
+ */
+static int tp_write_all(int fd, const char *p, size_t n)
+{
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += w;
+    n -= w;
+  }
+  return 0;
+}
+
+/* tp_fill_block copies the carry bytes at tail, the partial line left
+   over from the previous block, to the front of data and reads
+   standard input after them.  It reads again only while the block
+   holds no newline yet, so interactive input is still passed on line
+   by line.  It returns the length of the whole lines in the block and
+   sets *carry to the bytes after them; at end of input (*eof set)
+   that is everything read.
+ */
+static size_t tp_fill_block(char *data, const char *tail, size_t *carry,
+                            int *eof, int *error)
+{
+  size_t filled = *carry, len;
+  const char *nl = NULL;
+
+  memcpy(data, tail, filled);
+  while (nl == NULL && filled < TP_BLOCK_SIZE) {
+    ssize_t n = read(STDIN_FILENO, data + filled, TP_BLOCK_SIZE - filled);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      if (n < 0)
+        *error = errno;
+      *eof = 1;
+      break;
+    }
+    nl = tp_last_newline(data + filled, n);
+    filled += n;
+  }
+  len = (*eof || nl == NULL) ? filled : (size_t) (nl - data) + 1;
+  *carry = filled - len;
+  return len;
+}
+
+/* tp_bulk_producer reads standard input into the next free block.
+ */
+static void *tp_bulk_producer(void *arg)
+{ tp_buffer_t *sb = (tp_buffer_t *) arg;
+  const char *tail = NULL;   /* partial line left in the previous block */
+  size_t carry = 0;
+  int eof = 0;
+
+  while (!eof) {
+    tp_block_t *blk;
+
+    pthread_mutex_lock(&sb->lock);
+    while (sb->count == TP_BNUM)
+      pthread_cond_wait(&sb->new_space_cond, &sb->lock);
+    pthread_mutex_unlock(&sb->lock);
+
+    blk = &sb->b[sb->in];
+    blk->len = tp_fill_block(blk->data, tail, &carry, &eof, &sb->error);
+    blk->eof = eof;
+    tail = blk->data + blk->len;
+
+    sb->in = (sb->in + 1) % TP_BNUM;
+    pthread_mutex_lock(&sb->lock);
+    sb->count++;
+    pthread_cond_signal(&sb->new_data_cond);
+    pthread_mutex_unlock(&sb->lock);
+  }
+  return NULL;
+}
+
+/* tp_bulk_consumer converts and writes out one block at a time.
+   After a write error it keeps draining, so the producer never
+   waits forever on a full ring.
+ */
+static void *tp_bulk_consumer(void *arg)
+{ tp_buffer_t *sb = (tp_buffer_t *) arg;
+  int eof = 0;
+
+  while (!eof) {
+    tp_block_t *blk;
+
+    pthread_mutex_lock(&sb->lock);
+    while (sb->count == 0)
+      pthread_cond_wait(&sb->new_data_cond, &sb->lock);
+    pthread_mutex_unlock(&sb->lock);
+
+    blk = &sb->b[sb->out];
+    if (!sb->error) {
+      tp_upper(blk->data, blk->len);
+      if (tp_write_all(STDOUT_FILENO, blk->data, blk->len) < 0)
+        sb->error = errno;
+    }
+    eof = blk->eof;
+
+    sb->out = (sb->out + 1) % TP_BNUM;
+    pthread_mutex_lock(&sb->lock);
+    sb->count--;
+    pthread_cond_signal(&sb->new_space_cond);
+    pthread_mutex_unlock(&sb->lock);
+  }
+  return NULL;
+}
+
+/* tp_run_bulk runs the bulk pipeline until end of input.
+   It returns 0 on success and 1 if a read or write failed.
+ */
+static int tp_run_bulk(void)
+{ pthread_t th1, th2;
+  tp_buffer_t sb;
+  int i;
+
+  memset(&sb, 0, sizeof(sb));
+  pthread_mutex_init(&sb.lock, NULL);
+  pthread_cond_init(&sb.new_data_cond, NULL);
+  pthread_cond_init(&sb.new_space_cond, NULL);
+  for (i = 0; i < TP_BNUM; i++) {
+    if ((sb.b[i].data = (char *) malloc(TP_BLOCK_SIZE)) == NULL)
+      return 1;
+  }
+  pthread_create(&th1, NULL, tp_bulk_producer, &sb);
+  pthread_create(&th2, NULL, tp_bulk_consumer, &sb);
+  pthread_join(th1, NULL); pthread_join(th2, NULL);
+  for (i = 0; i < TP_BNUM; i++)
+    free(sb.b[i].data);
+  pthread_mutex_destroy(&sb.lock);
+  pthread_cond_destroy(&sb.new_data_cond);
+  pthread_cond_destroy(&sb.new_space_cond);
+  return sb.error ? 1 : 0;
+}
+
+#define TP_ANUM 4                  /* number of arena blocks */
+#define TP_LNUM 4096               /* number of line descriptors in the ring */
+#define TP_LBATCH 256              /* descriptors moved per lock acquisition */
+
+typedef struct tp_arena {
+  char *data;
+  size_t size;
+  int refs;                  /* descriptors into the block, plus one while
+                                the producer is still filling it */
+} tp_arena_t;
+
+typedef struct tp_line {
+  int block;                 /* arena block, or -1 for the end of input */
+  size_t off, len;           /* the line is data[off..off+len) */
+} tp_line_t;
+
+typedef struct tp_lines {
+  pthread_mutex_t lock;      /* protects count and refs */
+  pthread_cond_t
+    new_data_cond,           /* to wait when the ring is empty */
+    new_space_cond,          /* to wait when the ring is full */
+    free_block_cond;         /* to wait when every block is in use */
+  tp_line_t q[TP_LNUM];
+  int in,                    /* next descriptor to fill, producer only */
+      out,                   /* next descriptor to drain, consumer only */
+      count;                 /* the number of descriptors queued */
+  tp_arena_t a[TP_ANUM];
+  int error;                 /* errno of a failed read(), write() or malloc() */
+} tp_lines_t;
+
+/* tp_arena_get waits for a block nobody refers to any more and makes
+   sure it holds at least need bytes.  It returns the block, or -1 if
+   it could not be grown.
+ */
+static int tp_arena_get(tp_lines_t *sb, size_t need)
+{
+  int i = 0;
+
+  pthread_mutex_lock(&sb->lock);
+  for (;;) {
+    for (i = 0; i < TP_ANUM && sb->a[i].refs > 0; i++)
+      ;
+    if (i < TP_ANUM)
+      break;
+    pthread_cond_wait(&sb->free_block_cond, &sb->lock);
+  }
+  sb->a[i].refs = 1;
+  pthread_mutex_unlock(&sb->lock);
+
+  if (sb->a[i].size < need) {
+    char *data = (char *) realloc(sb->a[i].data, need);
+    if (data == NULL) {
+      sb->error = ENOMEM;
+      return -1;
+    }
+    sb->a[i].data = data;
+    sb->a[i].size = need;
+  }
+  return i;
+}
+
+/* tp_arena_put drops one reference to a block.  Called with the lock held.
+ */
+static void tp_arena_put(tp_lines_t *sb, int block)
+{
+  if (--sb->a[block].refs == 0)
+    pthread_cond_signal(&sb->free_block_cond);
+}
+
+/* tp_lines_push enqueues n descriptors, taking a block reference
+   for each one.
+ */
+static void tp_lines_push(tp_lines_t *sb, const tp_line_t *lines, int n)
+{
+  pthread_mutex_lock(&sb->lock);
+  while (n > 0) {
+    while (sb->count == TP_LNUM)
+      pthread_cond_wait(&sb->new_space_cond, &sb->lock);
+    for (; n > 0 && sb->count < TP_LNUM; n--, lines++) {
+      if (lines->block >= 0)
+        sb->a[lines->block].refs++;
+      sb->q[sb->in] = *lines;
+      sb->in = (sb->in + 1) % TP_LNUM;
+      sb->count++;
+    }
+    pthread_cond_signal(&sb->new_data_cond);
+  }
+  pthread_mutex_unlock(&sb->lock);
+}
+
+/* tp_arena_producer reads standard input into the current block and
+   enqueues the lines completed by each read().  When the block is
+   full, the partial line at its end moves to a fresh block of at
+   least twice its length, and never less than TP_BLOCK_SIZE.
+ */
+static void *tp_arena_producer(void *arg)
+{ tp_lines_t *sb = (tp_lines_t *) arg;
+  tp_line_t batch[TP_LBATCH];
+  int n = 0;
+  int cur;
+  size_t start = 0,          /* first byte of the partial line */
+         filled = 0;         /* bytes read into the block */
+
+  if ((cur = tp_arena_get(sb, TP_BLOCK_SIZE)) < 0)
+    goto done;
+  for (;;) {
+    tp_arena_t *blk = &sb->a[cur];
+    char *p, *end, *nl;
+    ssize_t r;
+
+    if (filled == blk->size) {
+      size_t carry = filled - start;
+      int next = tp_arena_get(sb, carry * 2 > TP_BLOCK_SIZE ? carry * 2 : TP_BLOCK_SIZE);
+      if (next < 0)
+        break;
+      memcpy(sb->a[next].data, blk->data + start, carry);
+      pthread_mutex_lock(&sb->lock);
+      tp_arena_put(sb, cur);
+      pthread_mutex_unlock(&sb->lock);
+      cur = next;
+      blk = &sb->a[cur];
+      start = 0;
+      filled = carry;
+    }
+
+    r = read(STDIN_FILENO, blk->data + filled, blk->size - filled);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0) {
+      if (r < 0)
+        sb->error = errno;
+      break;
+    }
+    p = blk->data + filled;
+    end = p + r;
+    while ((nl = (char *) memchr(p, '\n', end - p)) != NULL) {
+      batch[n].block = cur;
+      batch[n].off = start;
+      batch[n].len = nl + 1 - blk->data - start;
+      if (++n == TP_LBATCH) {
+        tp_lines_push(sb, batch, n);
+        n = 0;
+      }
+      start = nl + 1 - blk->data;
+      p = nl + 1;
+    }
+    filled += r;
+    if (n > 0) {
+      tp_lines_push(sb, batch, n);
+      n = 0;
+    }
+  }
+
+  /* the last line may lack its newline */
+  if (cur >= 0 && filled > start) {
+    batch[n].block = cur;
+    batch[n].off = start;
+    batch[n].len = filled - start;
+    n++;
+  }
+  if (cur >= 0) {
+    tp_lines_push(sb, batch, n);
+    n = 0;
+    pthread_mutex_lock(&sb->lock);
+    tp_arena_put(sb, cur);
+    pthread_mutex_unlock(&sb->lock);
+  }
+ done:
+  batch[n].block = -1;
+  batch[n].off = batch[n].len = 0;
+  tp_lines_push(sb, batch + n, 1);
+  return NULL;
+}
+
+/* tp_arena_flush converts and writes one run of adjacent lines.
+ */
+static void tp_arena_flush(tp_lines_t *sb, char *p, size_t len)
+{
+  if (len == 0 || sb->error)
+    return;
+  tp_upper(p, len);
+  if (tp_write_all(STDOUT_FILENO, p, len) < 0)
+    sb->error = errno;
+}
+
+/* tp_arena_consumer takes the queued descriptors in batches.  Lines
+   that follow each other in the same block are converted and written
+   as one run, so a block full of short lines still costs few calls.
+   The block references are dropped only after the write.
+ */
+static void *tp_arena_consumer(void *arg)
+{ tp_lines_t *sb = (tp_lines_t *) arg;
+  tp_line_t batch[TP_LBATCH];
+  int eof = 0;
+
+  while (!eof) {
+    char *run = NULL;
+    size_t run_len = 0;
+    int i, n;
+
+    pthread_mutex_lock(&sb->lock);
+    while (sb->count == 0)
+      pthread_cond_wait(&sb->new_data_cond, &sb->lock);
+    for (n = 0; n < TP_LBATCH && sb->count > 0; n++) {
+      batch[n] = sb->q[sb->out];
+      sb->out = (sb->out + 1) % TP_LNUM;
+      sb->count--;
+    }
+    pthread_cond_signal(&sb->new_space_cond);
+    pthread_mutex_unlock(&sb->lock);
+
+    for (i = 0; i < n; i++) {
+      char *line;
+      if (batch[i].block < 0) {
+        eof = 1;
+        break;
+      }
+      line = sb->a[batch[i].block].data + batch[i].off;
+      if (line != run + run_len) {
+        tp_arena_flush(sb, run, run_len);
+        run = line;
+        run_len = 0;
+      }
+      run_len += batch[i].len;
+    }
+    tp_arena_flush(sb, run, run_len);
+
+    pthread_mutex_lock(&sb->lock);
+    for (i = 0; i < n && batch[i].block >= 0; i++)
+      tp_arena_put(sb, batch[i].block);
+    pthread_mutex_unlock(&sb->lock);
+  }
+  return NULL;
+}
+
+/* tp_run_arena runs the arena pipeline until end of input.
+   It returns 0 on success and 1 if a read, write or allocation failed.
+ */
+static int tp_run_arena(void)
+{ pthread_t th1, th2;
+  tp_lines_t *sb;
+  int i, failed;
+
+  if ((sb = (tp_lines_t *) calloc(1, sizeof(*sb))) == NULL)
+    return 1;
+  pthread_mutex_init(&sb->lock, NULL);
+  pthread_cond_init(&sb->new_data_cond, NULL);
+  pthread_cond_init(&sb->new_space_cond, NULL);
+  pthread_cond_init(&sb->free_block_cond, NULL);
+  pthread_create(&th1, NULL, tp_arena_producer, sb);
+  pthread_create(&th2, NULL, tp_arena_consumer, sb);
+  pthread_join(th1, NULL); pthread_join(th2, NULL);
+  failed = sb->error ? 1 : 0;
+  pthread_mutex_destroy(&sb->lock);
+  pthread_cond_destroy(&sb->new_data_cond);
+  pthread_cond_destroy(&sb->new_space_cond);
+  pthread_cond_destroy(&sb->free_block_cond);
+  for (i = 0; i < TP_ANUM; i++)
+    free(sb->a[i].data);
+  free(sb);
+  return failed;
+}
+
+#define TP_WORKERS_MAX 64          /* most worker threads in the parallel mode */
+
+/* the life of a slot in the parallel mode, in this order */
+enum { TP_FREE, TP_FILLED, TP_BUSY, TP_DONE };
+
+typedef struct tp_batch {
+  tp_block_t blk;
+  int state;                 /* TP_FREE .. TP_DONE */
+} tp_batch_t;
+
+typedef struct tp_parallel {
+  pthread_mutex_t lock;      /* protects the states and sequence numbers */
+  pthread_cond_t
+    free_cond,               /* producer waits for slot next_fill to be free */
+    work_cond,               /* workers wait for a filled slot */
+    done_cond;               /* writer waits for slot next_write to be done */
+  tp_batch_t *slot;          /* batch number s lives in slot[s % nslots] */
+  int nslots;
+  long next_fill,            /* number of the next batch to read */
+       next_claim,           /* number of the next batch to convert */
+       next_write;           /* number of the next batch to write */
+  int claimed_eof;           /* the last batch has been claimed */
+  int error;                 /* errno of a failed read() or write() */
+} tp_parallel_t;
+
+/* tp_parallel_producer numbers the blocks as it fills them.
+ */
+static void *tp_parallel_producer(void *arg)
+{ tp_parallel_t *sp = (tp_parallel_t *) arg;
+  const char *tail = NULL;
+  size_t carry = 0;
+  int eof = 0;
+
+  while (!eof) {
+    tp_batch_t *b = &sp->slot[sp->next_fill % sp->nslots];
+
+    pthread_mutex_lock(&sp->lock);
+    while (b->state != TP_FREE)
+      pthread_cond_wait(&sp->free_cond, &sp->lock);
+    pthread_mutex_unlock(&sp->lock);
+
+    b->blk.len = tp_fill_block(b->blk.data, tail, &carry, &eof, &sp->error);
+    b->blk.eof = eof;
+    tail = b->blk.data + b->blk.len;
+
+    pthread_mutex_lock(&sp->lock);
+    b->state = TP_FILLED;
+    sp->next_fill++;
+    pthread_cond_signal(&sp->work_cond);
+    pthread_mutex_unlock(&sp->lock);
+  }
+  return NULL;
+}
+
+/* tp_parallel_worker claims batches in number order and converts
+   them outside the lock.  A worker that claims the last batch wakes
+   the others so they can exit.
+ */
+static void *tp_parallel_worker(void *arg)
+{ tp_parallel_t *sp = (tp_parallel_t *) arg;
+
+  for (;;) {
+    tp_batch_t *b;
+
+    pthread_mutex_lock(&sp->lock);
+    for (;;) {
+      if (sp->claimed_eof) {
+        pthread_mutex_unlock(&sp->lock);
+        return NULL;
+      }
+      if (sp->next_claim < sp->next_fill)
+        break;
+      pthread_cond_wait(&sp->work_cond, &sp->lock);
+    }
+    b = &sp->slot[sp->next_claim % sp->nslots];
+    b->state = TP_BUSY;
+    sp->next_claim++;
+    if (b->blk.eof) {
+      sp->claimed_eof = 1;
+      pthread_cond_broadcast(&sp->work_cond);
+    }
+    pthread_mutex_unlock(&sp->lock);
+
+    tp_upper(b->blk.data, b->blk.len);
+
+    pthread_mutex_lock(&sp->lock);
+    b->state = TP_DONE;
+    if (b == &sp->slot[sp->next_write % sp->nslots])
+      pthread_cond_signal(&sp->done_cond);
+    pthread_mutex_unlock(&sp->lock);
+  }
+}
+
+/* tp_parallel_writer is the reorder stage: it writes the batches by
+   number, waiting for the next one even if later ones are done.
+ */
+static void *tp_parallel_writer(void *arg)
+{ tp_parallel_t *sp = (tp_parallel_t *) arg;
+  int eof = 0;
+
+  while (!eof) {
+    tp_batch_t *b = &sp->slot[sp->next_write % sp->nslots];
+
+    pthread_mutex_lock(&sp->lock);
+    while (b->state != TP_DONE)
+      pthread_cond_wait(&sp->done_cond, &sp->lock);
+    pthread_mutex_unlock(&sp->lock);
+
+    if (!sp->error && tp_write_all(STDOUT_FILENO, b->blk.data, b->blk.len) < 0)
+      sp->error = errno;
+    eof = b->blk.eof;
+
+    pthread_mutex_lock(&sp->lock);
+    b->state = TP_FREE;
+    sp->next_write++;
+    pthread_cond_signal(&sp->free_cond);
+    pthread_mutex_unlock(&sp->lock);
+  }
+  return NULL;
+}
+
+/* tp_run_parallel runs the parallel pipeline with the given number
+   of workers until end of input.  It returns 0 on success and 1 if
+   a read, write or allocation failed.
+ */
+static int tp_run_parallel(int workers)
+{ pthread_t producer, writer, worker[TP_WORKERS_MAX];
+  tp_parallel_t sp;
+  int i, failed = 0;
+
+  if (workers < 1 || workers > TP_WORKERS_MAX)
+    return 1;
+  memset(&sp, 0, sizeof(sp));
+  /* two batches per worker keep each one busy while the writer drains */
+  sp.nslots = 2 * workers + 2;
+  if ((sp.slot = (tp_batch_t *) calloc(sp.nslots, sizeof(tp_batch_t))) == NULL)
+    return 1;
+  for (i = 0; i < sp.nslots; i++) {
+    if ((sp.slot[i].blk.data = (char *) malloc(TP_BLOCK_SIZE)) == NULL)
+      failed = 1;
+  }
+  if (!failed) {
+    pthread_mutex_init(&sp.lock, NULL);
+    pthread_cond_init(&sp.free_cond, NULL);
+    pthread_cond_init(&sp.work_cond, NULL);
+    pthread_cond_init(&sp.done_cond, NULL);
+    pthread_create(&producer, NULL, tp_parallel_producer, &sp);
+    for (i = 0; i < workers; i++)
+      pthread_create(&worker[i], NULL, tp_parallel_worker, &sp);
+    pthread_create(&writer, NULL, tp_parallel_writer, &sp);
+    pthread_join(producer, NULL);
+    for (i = 0; i < workers; i++)
+      pthread_join(worker[i], NULL);
+    pthread_join(writer, NULL);
+    pthread_mutex_destroy(&sp.lock);
+    pthread_cond_destroy(&sp.free_cond);
+    pthread_cond_destroy(&sp.work_cond);
+    pthread_cond_destroy(&sp.done_cond);
+    failed = sp.error ? 1 : 0;
+  }
+  for (i = 0; i < sp.nslots; i++)
+    free(sp.slot[i].blk.data);
+  free(sp.slot);
+  return failed;
+}
+
+/* tp_main parses the options described at the top of this file and
+   runs the mode they select.  It returns the exit status of that
+   mode, 1 on a bad option, or -1 if no mode was selected and the
+   caller should run its teaching version.
+ */
+static int tp_main(int argc, char *argv[])
+{
+  int opt, bulk = 0, arena = 0, workers = 0;
+  const char *kernel = NULL;
+
+  while ((opt = getopt(argc, argv, "abj:k:")) != -1) {
+    switch (opt) {
+    case 'a':
+      arena = 1;
+      break;
+    case 'b':
+      bulk = 1;
+      break;
+    case 'j':
+      workers = atoi(optarg);
+      if (workers < 1 || workers > TP_WORKERS_MAX) {
+        fprintf(stderr, "%s: workers must be 1..%d\n", argv[0], TP_WORKERS_MAX);
+        return 1;
+      }
+      break;
+    case 'k':
+      kernel = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-a | -b | -j workers] [-k avx2|sse2|scalar]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (tp_select_upper(kernel) == NULL) {
+    fprintf(stderr, "%s: kernel %s is not supported\n", argv[0], kernel);
+    return 1;
+  }
+  if (workers)
+    return tp_run_parallel(workers);
+  if (arena)
+    return tp_run_arena();
+  if (bulk)
+    return tp_run_bulk();
+  return -1;
+}
+
+#endif /* TEXTPIPE_H */
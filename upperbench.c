@@ -0,0 +1,137 @@
+/* upperbench.c
+
+   Benchmark of the case conversion kernels in textcase.h.
+
+   Every kernel the CPU supports is run over the same text at a few
+   buffer sizes, from one short line up to a whole bulk-mode block.
+   Each result is compared with the scalar kernel's output, and the
+   throughput is printed with the speedup over the scalar kernel.
+
+   The text is random printable ASCII with newlines, mixed case, plus
+   some bytes >= 0x80 that every kernel must leave alone.
+
+   usage: upperbench [-m megabytes_per_run]
+*/
+
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include "textcase.h"
+
+#define MAX_SIZE (1 << 20)  /* a whole block, as TP_BLOCK_SIZE in textpipe.h */
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill(char *p, size_t n)
+{
+  size_t i;
+  srand(1);
+  for (i = 0; i < n; i++) {
+    int r = rand() % 100;
+    if (r == 0)
+      p[i] = '\n';
+    else if (r == 1)
+      p[i] = (char) (0x80 + rand() % 128);
+    else
+      p[i] = (char) (' ' + rand() % 95);
+  }
+}
+
+/* run converts the text in buffers of size bytes until total bytes
+   are done, and returns the throughput in GB/s.  The text is copied
+   into the work buffer first, as the consumer would find it fresh
+   in a block; the copy is timed for every kernel alike.
+ */
+static double run(void (*upper)(char *, size_t), const char *text,
+                  char *work, size_t size, size_t total)
+{
+  size_t done;
+  double start = now();
+  for (done = 0; done < total; done += size) {
+    memcpy(work, text, size);
+    upper(work, size);
+  }
+  return total / (now() - start) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+  static const size_t sizes[] = { 64, 256, 4096, 65536, MAX_SIZE };
+  size_t total = (size_t) 256 << 20;
+  char *text, *expect, *work;
+  const tp_kernel_t *k;
+  int opt, errors = 0;
+  unsigned i;
+
+  while ((opt = getopt(argc, argv, "m:")) != -1) {
+    switch (opt) {
+    case 'm':
+      total = (size_t) atoi(optarg) << 20;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-m megabytes_per_run]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (total == 0) {
+    fprintf(stderr, "%s: nothing to convert\n", argv[0]);
+    return 1;
+  }
+
+  text = (char *) malloc(MAX_SIZE);
+  expect = (char *) malloc(MAX_SIZE);
+  work = (char *) malloc(MAX_SIZE);
+  if (text == NULL || expect == NULL || work == NULL)
+    return 1;
+  fill(text, MAX_SIZE);
+  for (i = 0; i < MAX_SIZE; i++)
+    expect[i] = (char) toupper((unsigned char) text[i]);
+
+  k = tp_select_upper(NULL);
+  printf("auto-selected kernel: %s, %lu MB per run, GB/s (speedup over scalar)\n",
+         k->name, (unsigned long) (total >> 20));
+  printf("%8s", "bytes");
+  for (k = tp_kernels; k->name != NULL; k++) {
+    if (k->supported())
+      printf(" %16s", k->name);
+  }
+  printf("\n");
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t size = sizes[i];
+    double scalar = run(tp_upper_scalar, text, work, size, total);
+
+    printf("%8lu", (unsigned long) size);
+    for (k = tp_kernels; k->name != NULL; k++) {
+      double gbs;
+      if (!k->supported())
+        continue;
+      /* an odd length and offset exercise the unaligned loads and tail */
+      memcpy(work, text, size);
+      k->upper(work + 1, size - 3);
+      if (memcmp(work + 1, expect + 1, size - 3) != 0
+          || work[0] != text[0] || memcmp(work + size - 2, text + size - 2, 2) != 0) {
+        printf(" %16s", "WRONG");
+        errors++;
+        continue;
+      }
+      gbs = k->upper == tp_upper_scalar ? scalar : run(k->upper, text, work, size, total);
+      printf(" %7.2f(%6.2fx)", gbs, gbs / scalar);
+    }
+    printf("\n");
+  }
+
+  free(text);
+  free(expect);
+  free(work);
+  return errors ? 1 : 0;
+}